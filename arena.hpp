@@ -0,0 +1,147 @@
+#pragma once
+#include "option.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <vector>
+
+constexpr std::size_t kInlineKeySize = 15;
+constexpr std::size_t kKeyArenaMinChunkSize = 4 * KiB;
+constexpr std::size_t kKeyArenaChunkSize = 64 * KiB;
+
+// the memory an index takes for its keys and positions
+struct IndexMemoryStat {
+  std::uint64_t keyCount = 0;
+  // bytes of the keys themselves
+  std::uint64_t keyBytes = 0;
+  // bytes allocated by the index: its tables or nodes and the arenas holding the keys
+  std::uint64_t indexBytes = 0;
+  // arena bytes of removed keys, freed once the index is compacted
+  std::uint64_t deadKeyBytes = 0;
+
+  auto operator+=(IndexMemoryStat const& rhs) -> IndexMemoryStat&
+  {
+    keyCount += rhs.keyCount;
+    keyBytes += rhs.keyBytes;
+    indexBytes += rhs.indexBytes;
+    deadKeyBytes += rhs.deadKeyBytes;
+    return *this;
+  }
+};
+
+// a key as the index stores it, in 16 bytes: a key of up to `kInlineKeySize` bytes is kept in place
+// with its size in the last byte, a longer one is a pointer into a KeyArena and its size. the view of
+// an inline key points into the ref itself and is only valid while the ref is not moved.
+class KeyRef {
+public:
+  KeyRef() = default;
+
+  static auto inlined(std::span<std::byte const> key) -> KeyRef
+  {
+    auto ref = KeyRef();
+    std::memcpy(ref.mBytes.data(), key.data(), key.size());
+    ref.mBytes[kTagOffset] = std::byte(key.size());
+    return ref;
+  }
+  static auto external(std::byte const* data, std::uint32_t size) -> KeyRef
+  {
+    auto ref = KeyRef();
+    std::memcpy(ref.mBytes.data(), &data, sizeof(data));
+    std::memcpy(ref.mBytes.data() + sizeof(data), &size, sizeof(size));
+    ref.mBytes[kTagOffset] = kExternalTag;
+    return ref;
+  }
+
+  auto isInline() const -> bool { return mBytes[kTagOffset] != kExternalTag; }
+  auto size() const -> std::size_t
+  {
+    if (isInline()) {
+      return std::to_integer<std::size_t>(mBytes[kTagOffset]);
+    }
+    auto size = std::uint32_t();
+    std::memcpy(&size, mBytes.data() + sizeof(std::byte const*), sizeof(size));
+    return size;
+  }
+  auto view() const -> std::span<std::byte const>
+  {
+    if (isInline()) {
+      return {mBytes.data(), size()};
+    }
+    auto data = static_cast<std::byte const*>(nullptr);
+    std::memcpy(&data, mBytes.data(), sizeof(data));
+    return {data, size()};
+  }
+
+private:
+  static constexpr std::size_t kTagOffset = kInlineKeySize;
+  static constexpr std::byte kExternalTag = std::byte(0xff);
+
+  alignas(8) std::array<std::byte, 16> mBytes{};
+};
+static_assert(sizeof(KeyRef) == 16);
+
+// the storage of the index keys too long to be inlined, copied back to back into chunks that double from
+// `kKeyArenaMinChunkSize` up to `kKeyArenaChunkSize`, so a small index does not hold a large chunk. a
+// removed key only counts as dead until `compact` is called on the owner, which stores the live keys
+// into a new arena and drops the old one. chunks never move, so refs stay valid as the arena grows
+// and when it is moved. not synchronized, the owner locks around it.
+class KeyArena {
+public:
+  KeyArena() = default;
+  KeyArena(KeyArena const&) = delete;
+  KeyArena& operator=(KeyArena const&) = delete;
+  KeyArena(KeyArena&&) = default;
+  KeyArena& operator=(KeyArena&&) = default;
+  ~KeyArena() = default;
+
+  auto store(std::span<std::byte const> key) -> KeyRef
+  {
+    if (key.size() <= kInlineKeySize) {
+      return KeyRef::inlined(key);
+    }
+    auto data = allocate(key.size());
+    std::memcpy(data, key.data(), key.size());
+    return KeyRef::external(data, std::uint32_t(key.size()));
+  }
+  auto release(KeyRef const& key) -> void
+  {
+    if (!key.isInline()) {
+      mDeadBytes += key.size();
+    }
+  }
+  // bytes of all chunks
+  auto allocatedBytes() const -> std::size_t { return mAllocatedBytes; }
+  // bytes of removed keys, given back by compaction
+  auto deadBytes() const -> std::size_t { return mDeadBytes; }
+
+private:
+  auto allocate(std::size_t size) -> std::byte*
+  {
+    if (mFree < size) {
+      auto chunkSize = std::clamp(mAllocatedBytes, kKeyArenaMinChunkSize, kKeyArenaChunkSize);
+      // a large key gets a chunk of its own, so the current chunk keeps its free space
+      if (size > chunkSize / 4) {
+        mChunks.push_back(std::make_unique_for_overwrite<std::byte[]>(size));
+        mAllocatedBytes += size;
+        return mChunks.back().get();
+      }
+      mChunks.push_back(std::make_unique_for_overwrite<std::byte[]>(chunkSize));
+      mAllocatedBytes += chunkSize;
+      mCurrent = mChunks.back().get();
+      mFree = chunkSize;
+    }
+    auto data = mCurrent;
+    mCurrent += size;
+    mFree -= size;
+    return data;
+  }
+
+  std::vector<std::unique_ptr<std::byte[]>> mChunks;
+  std::byte* mCurrent = nullptr;
+  std::size_t mFree = 0;
+  std::size_t mAllocatedBytes = 0;
+  std::size_t mDeadBytes = 0;
+};
@@ -0,0 +1,738 @@
+#pragma once
+#include "arena.hpp"
+#include "segment.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// three way comparison of keys as unsigned bytes, on a common prefix the shorter key is smaller
+inline auto compareKeys(std::span<std::byte const> lhs, std::span<std::byte const> rhs) -> int
+{
+  auto n = std::min(lhs.size(), rhs.size());
+  if (n > 0) {
+    if (auto r = std::memcmp(lhs.data(), rhs.data(), n); r != 0) {
+      return r;
+    }
+  }
+  return lhs.size() < rhs.size() ? -1 : (lhs.size() > rhs.size() ? 1 : 0);
+}
+
+namespace art {
+enum class NodeKind : std::uint8_t { Leaf, Node4, Node16, Node48, Node256 };
+
+struct Node {
+  NodeKind kind;
+};
+struct NodeDeleter {
+  auto operator()(Node* node) const -> void;
+};
+using NodePtr = std::unique_ptr<Node, NodeDeleter>;
+
+struct Leaf : Node {
+  Leaf(KeyRef k, ChunkPosition p) : Node{NodeKind::Leaf}, key(k), position(p) {}
+  KeyRef key;
+  PackedPosition position;
+};
+// an inner node holds the bytes every key below it shares after the byte that led to it, and the leaf of
+// the key that ends right after them, if there is one
+struct Inner : Node {
+  explicit Inner(NodeKind k) : Node{k} {}
+  std::vector<std::byte> prefix;
+  NodePtr value;
+  std::uint16_t count = 0;
+};
+// up to 4 and 16 children, their key bytes sorted
+struct Node4 : Inner {
+  Node4() : Inner(NodeKind::Node4) {}
+  std::array<std::uint8_t, 4> keys{};
+  std::array<NodePtr, 4> children;
+};
+struct Node16 : Inner {
+  Node16() : Inner(NodeKind::Node16) {}
+  std::array<std::uint8_t, 16> keys{};
+  std::array<NodePtr, 16> children;
+};
+// up to 48 children, a key byte maps to its child slot plus one, 0 when it has none
+struct Node48 : Inner {
+  Node48() : Inner(NodeKind::Node48) {}
+  std::array<std::uint8_t, 256> index{};
+  std::array<NodePtr, 48> children;
+};
+struct Node256 : Inner {
+  Node256() : Inner(NodeKind::Node256) {}
+  std::array<NodePtr, 256> children;
+};
+
+inline auto NodeDeleter::operator()(Node* node) const -> void
+{
+  switch (node->kind) {
+  case NodeKind::Leaf:
+    delete static_cast<Leaf*>(node);
+    break;
+  case NodeKind::Node4:
+    delete static_cast<Node4*>(node);
+    break;
+  case NodeKind::Node16:
+    delete static_cast<Node16*>(node);
+    break;
+  case NodeKind::Node48:
+    delete static_cast<Node48*>(node);
+    break;
+  case NodeKind::Node256:
+    delete static_cast<Node256*>(node);
+    break;
+  }
+}
+
+inline auto asLeaf(Node const* node) -> Leaf* { return static_cast<Leaf*>(const_cast<Node*>(node)); }
+inline auto asInner(Node const* node) -> Inner* { return static_cast<Inner*>(const_cast<Node*>(node)); }
+inline auto makeLeaf(KeyRef key, ChunkPosition position) -> NodePtr
+{
+  return NodePtr(new Leaf(key, position));
+}
+inline auto byteAt(std::span<std::byte const> key, std::size_t i) -> std::uint8_t
+{
+  return std::to_integer<std::uint8_t>(key[i]);
+}
+
+inline auto findChild(Inner* node, std::uint8_t byte) -> NodePtr*
+{
+  switch (node->kind) {
+  case NodeKind::Node4: {
+    auto n = static_cast<Node4*>(node);
+    for (auto i = 0; i < n->count && n->keys[i] <= byte; i++) {
+      if (n->keys[i] == byte) {
+        return &n->children[i];
+      }
+    }
+    return nullptr;
+  }
+  case NodeKind::Node16: {
+    auto n = static_cast<Node16*>(node);
+    auto end = n->keys.begin() + n->count;
+    auto it = std::lower_bound(n->keys.begin(), end, byte);
+    return it != end && *it == byte ? &n->children[it - n->keys.begin()] : nullptr;
+  }
+  case NodeKind::Node48: {
+    auto n = static_cast<Node48*>(node);
+    return n->index[byte] != 0 ? &n->children[n->index[byte] - 1] : nullptr;
+  }
+  case NodeKind::Node256: {
+    auto n = static_cast<Node256*>(node);
+    return n->children[byte] != nullptr ? &n->children[byte] : nullptr;
+  }
+  default:
+    return nullptr;
+  }
+}
+
+// call `fn(byte, child)` for every child in key byte order, or in reverse, until it returns false
+template <typename Fn>
+auto forEachChild(Inner const* node, bool reverse, Fn&& fn) -> bool
+{
+  auto sorted = [&](auto const* n) {
+    for (auto i = 0; i < n->count; i++) {
+      auto j = reverse ? n->count - 1 - i : i;
+      if (!fn(n->keys[j], n->children[j].get())) {
+        return false;
+      }
+    }
+    return true;
+  };
+  switch (node->kind) {
+  case NodeKind::Node4:
+    return sorted(static_cast<Node4 const*>(node));
+  case NodeKind::Node16:
+    return sorted(static_cast<Node16 const*>(node));
+  case NodeKind::Node48: {
+    auto n = static_cast<Node48 const*>(node);
+    for (auto i = 0; i < 256; i++) {
+      auto byte = std::uint8_t(reverse ? 255 - i : i);
+      if (n->index[byte] != 0 && !fn(byte, n->children[n->index[byte] - 1].get())) {
+        return false;
+      }
+    }
+    return true;
+  }
+  case NodeKind::Node256: {
+    auto n = static_cast<Node256 const*>(node);
+    for (auto i = 0; i < 256; i++) {
+      auto byte = std::uint8_t(reverse ? 255 - i : i);
+      if (n->children[byte] != nullptr && !fn(byte, n->children[byte].get())) {
+        return false;
+      }
+    }
+    return true;
+  }
+  default:
+    return true;
+  }
+}
+
+template <typename To>
+auto moveInner(Inner* from) -> std::unique_ptr<To>
+{
+  auto to = std::make_unique<To>();
+  to->prefix = std::move(from->prefix);
+  to->value = std::move(from->value);
+  return to;
+}
+
+// copy the children of a sorted node into `to` through `add(byte, child)`
+template <typename From, typename Add>
+auto moveSorted(From* from, Add&& add) -> void
+{
+  for (auto i = 0; i < from->count; i++) {
+    add(from->keys[i], std::move(from->children[i]));
+  }
+}
+
+template <typename N>
+auto insertSorted(N* n, std::uint8_t byte, NodePtr child) -> void
+{
+  auto i = int(n->count);
+  for (; i > 0 && n->keys[i - 1] > byte; i--) {
+    n->keys[i] = n->keys[i - 1];
+    n->children[i] = std::move(n->children[i - 1]);
+  }
+  n->keys[i] = byte;
+  n->children[i] = std::move(child);
+  n->count++;
+}
+
+// add a child under a byte the node has no child for, growing the node when it is full
+inline auto addChild(NodePtr& ref, std::uint8_t byte, NodePtr child) -> void
+{
+  auto node = asInner(ref.get());
+  switch (node->kind) {
+  case NodeKind::Node4: {
+    auto n = static_cast<Node4*>(node);
+    if (n->count < 4) {
+      insertSorted(n, byte, std::move(child));
+      return;
+    }
+    auto big = moveInner<Node16>(n);
+    moveSorted(n, [&](std::uint8_t b, NodePtr c) { insertSorted(big.get(), b, std::move(c)); });
+    ref = NodePtr(big.release());
+    break;
+  }
+  case NodeKind::Node16: {
+    auto n = static_cast<Node16*>(node);
+    if (n->count < 16) {
+      insertSorted(n, byte, std::move(child));
+      return;
+    }
+    auto big = moveInner<Node48>(n);
+    moveSorted(n, [&](std::uint8_t b, NodePtr c) {
+      big->children[big->count] = std::move(c);
+      big->index[b] = ++big->count;
+    });
+    ref = NodePtr(big.release());
+    break;
+  }
+  case NodeKind::Node48: {
+    auto n = static_cast<Node48*>(node);
+    if (n->count < 48) {
+      auto slot = std::size_t(0);
+      while (n->children[slot] != nullptr) {
+        slot++;
+      }
+      n->children[slot] = std::move(child);
+      n->index[byte] = std::uint8_t(slot + 1);
+      n->count++;
+      return;
+    }
+    auto big = moveInner<Node256>(n);
+    for (auto b = 0; b < 256; b++) {
+      if (n->index[b] != 0) {
+        big->children[b] = std::move(n->children[n->index[b] - 1]);
+        big->count++;
+      }
+    }
+    ref = NodePtr(big.release());
+    break;
+  }
+  case NodeKind::Node256: {
+    auto n = static_cast<Node256*>(node);
+    n->children[byte] = std::move(child);
+    n->count++;
+    return;
+  }
+  default:
+    return;
+  }
+  addChild(ref, byte, std::move(child));
+}
+
+// put a node that has lost a child or its value back into shape: a node left with only its value
+// becomes that leaf, a node with a single child is merged into it, sparse nodes shrink
+inline auto normalize(NodePtr& ref) -> void
+{
+  auto node = asInner(ref.get());
+  if (node->count == 0) {
+    ref = std::move(node->value);
+    return;
+  }
+  if (node->count == 1 && node->value == nullptr) {
+    auto byte = std::uint8_t();
+    forEachChild(node, false, [&](std::uint8_t b, Node const*) {
+      byte = b;
+      return false;
+    });
+    auto child = std::move(*findChild(node, byte));
+    if (child->kind != NodeKind::Leaf) {
+      auto inner = asInner(child.get());
+      auto prefix = std::move(node->prefix);
+      prefix.push_back(std::byte(byte));
+      prefix.insert(prefix.end(), inner->prefix.begin(), inner->prefix.end());
+      inner->prefix = std::move(prefix);
+    }
+    ref = std::move(child);
+    return;
+  }
+  switch (node->kind) {
+  case NodeKind::Node16:
+    if (node->count <= 3) {
+      auto n = static_cast<Node16*>(node);
+      auto small = moveInner<Node4>(n);
+      moveSorted(n, [&](std::uint8_t b, NodePtr c) { insertSorted(small.get(), b, std::move(c)); });
+      ref = NodePtr(small.release());
+    }
+    break;
+  case NodeKind::Node48:
+    if (node->count <= 12) {
+      auto n = static_cast<Node48*>(node);
+      auto small = moveInner<Node16>(n);
+      for (auto b = 0; b < 256; b++) {
+        if (n->index[b] != 0) {
+          insertSorted(small.get(), std::uint8_t(b), std::move(n->children[n->index[b] - 1]));
+        }
+      }
+      ref = NodePtr(small.release());
+    }
+    break;
+  case NodeKind::Node256:
+    if (node->count <= 37) {
+      auto n = static_cast<Node256*>(node);
+      auto small = moveInner<Node48>(n);
+      for (auto b = 0; b < 256; b++) {
+        if (n->children[b] != nullptr) {
+          small->children[small->count] = std::move(n->children[b]);
+          small->index[b] = ++small->count;
+        }
+      }
+      ref = NodePtr(small.release());
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+inline auto removeChild(NodePtr& ref, std::uint8_t byte) -> void
+{
+  auto node = asInner(ref.get());
+  auto removeSorted = [&](auto* n) {
+    auto i = 0;
+    while (n->keys[i] != byte) {
+      i++;
+    }
+    for (; i + 1 < n->count; i++) {
+      n->keys[i] = n->keys[i + 1];
+      n->children[i] = std::move(n->children[i + 1]);
+    }
+    n->children[n->count - 1].reset();
+    n->count--;
+  };
+  switch (node->kind) {
+  case NodeKind::Node4:
+    removeSorted(static_cast<Node4*>(node));
+    break;
+  case NodeKind::Node16:
+    removeSorted(static_cast<Node16*>(node));
+    break;
+  case NodeKind::Node48: {
+    auto n = static_cast<Node48*>(node);
+    n->children[n->index[byte] - 1].reset();
+    n->index[byte] = 0;
+    n->count--;
+    break;
+  }
+  case NodeKind::Node256: {
+    auto n = static_cast<Node256*>(node);
+    n->children[byte].reset();
+    n->count--;
+    break;
+  }
+  default:
+    break;
+  }
+  normalize(ref);
+}
+
+// the number of bytes of the node's prefix that match `key` from `depth`
+inline auto matchPrefix(Inner const* node, std::span<std::byte const> key, std::size_t depth) -> std::size_t
+{
+  auto n = std::min(node->prefix.size(), key.size() - std::min(key.size(), depth));
+  auto i = std::size_t(0);
+  while (i < n && node->prefix[i] == key[depth + i]) {
+    i++;
+  }
+  return i;
+}
+} // namespace art
+
+// an adaptive radix tree: inner nodes grow from 4 to 16, 48 and 256 children as keys are added and
+// shrink back as they are removed, and a chain of single child nodes is stored as one node's prefix.
+// keys are kept in byte order, so besides point lookups it visits ranges in either direction.
+// not synchronized, callers lock around it.
+class ArtTree {
+public:
+  ArtTree() = default;
+  ArtTree(ArtTree const&) = delete;
+  ArtTree& operator=(ArtTree const&) = delete;
+  ArtTree(ArtTree&&) = default;
+  ArtTree& operator=(ArtTree&&) = default;
+  ~ArtTree() = default;
+
+  auto put(std::span<std::byte const> key, ChunkPosition position) -> void
+  {
+    if (insert(mRoot, key, position, 0, mArena)) {
+      mSize++;
+      mKeyBytes += key.size();
+    }
+  }
+  auto get(std::span<std::byte const> key) const -> std::optional<ChunkPosition>
+  {
+    auto node = mRoot.get();
+    auto depth = std::size_t(0);
+    while (node != nullptr) {
+      if (node->kind == art::NodeKind::Leaf) {
+        auto leaf = art::asLeaf(node);
+        return compareKeys(leaf->key.view(), key) == 0 ? std::optional(leaf->position.unpack()) : std::nullopt;
+      }
+      auto inner = art::asInner(node);
+      if (art::matchPrefix(inner, key, depth) != inner->prefix.size()) {
+        return std::nullopt;
+      }
+      depth += inner->prefix.size();
+      if (depth == key.size()) {
+        if (inner->value == nullptr) {
+          return std::nullopt;
+        }
+        return art::asLeaf(inner->value.get())->position.unpack();
+      }
+      auto child = art::findChild(inner, art::byteAt(key, depth));
+      node = child != nullptr ? child->get() : nullptr;
+      depth++;
+    }
+    return std::nullopt;
+  }
+  auto remove(std::span<std::byte const> key) -> std::optional<ChunkPosition>
+  {
+    auto position = erase(mRoot, key, 0, mArena);
+    if (position.has_value()) {
+      mSize--;
+      mKeyBytes -= key.size();
+    }
+    return position;
+  }
+  auto size() const -> std::size_t { return mSize; }
+
+  // call `fn(key, position)` for every key in [low, high) in ascending order until it returns false,
+  // an empty bound is unbounded
+  template <typename Fn>
+  auto ascend(std::span<std::byte const> low, std::span<std::byte const> high, Fn&& fn) const -> void
+  {
+    if (mRoot == nullptr) {
+      return;
+    }
+    auto visit = [&](std::span<std::byte const> key, ChunkPosition const& position) {
+      return (!high.empty() && compareKeys(key, high) >= 0) ? false : fn(key, position);
+    };
+    ascendFrom(mRoot.get(), low, 0, !low.empty(), visit);
+  }
+  // the keys in [low, high) in descending order
+  template <typename Fn>
+  auto descend(std::span<std::byte const> low, std::span<std::byte const> high, Fn&& fn) const -> void
+  {
+    if (mRoot == nullptr) {
+      return;
+    }
+    auto visit = [&](std::span<std::byte const> key, ChunkPosition const& position) {
+      return (!low.empty() && compareKeys(key, low) < 0) ? false : fn(key, position);
+    };
+    descendBelow(mRoot.get(), high, 0, !high.empty(), visit);
+  }
+  // every key in ascending order
+  template <typename Fn>
+  auto forEach(Fn&& fn) const -> void
+  {
+    ascend({}, {}, [&](std::span<std::byte const> key, ChunkPosition const& position) {
+      fn(key, position);
+      return true;
+    });
+  }
+  // copy the live keys into a new arena if any were removed, which frees the space of the dead ones
+  auto compact() -> void
+  {
+    if (mRoot == nullptr || mArena.deadBytes() == 0) {
+      return;
+    }
+    auto arena = KeyArena();
+    forEachNode(mRoot.get(), [&](art::Node const* node) {
+      if (node->kind == art::NodeKind::Leaf) {
+        art::asLeaf(node)->key = arena.store(art::asLeaf(node)->key.view());
+      }
+    });
+    mArena = std::move(arena);
+  }
+  // walks every node, the cost of the call grows with the tree
+  auto memoryStat() const -> IndexMemoryStat
+  {
+    auto nodeBytes = std::size_t(0);
+    if (mRoot != nullptr) {
+      forEachNode(mRoot.get(), [&](art::Node const* node) {
+        switch (node->kind) {
+        case art::NodeKind::Leaf:
+          nodeBytes += sizeof(art::Leaf);
+          return;
+        case art::NodeKind::Node4:
+          nodeBytes += sizeof(art::Node4);
+          break;
+        case art::NodeKind::Node16:
+          nodeBytes += sizeof(art::Node16);
+          break;
+        case art::NodeKind::Node48:
+          nodeBytes += sizeof(art::Node48);
+          break;
+        case art::NodeKind::Node256:
+          nodeBytes += sizeof(art::Node256);
+          break;
+        }
+        nodeBytes += art::asInner(node)->prefix.capacity();
+      });
+    }
+    return IndexMemoryStat{
+        .keyCount = mSize,
+        .keyBytes = mKeyBytes,
+        .indexBytes = nodeBytes + mArena.allocatedBytes(),
+        .deadKeyBytes = mArena.deadBytes(),
+    };
+  }
+
+private:
+  static auto insert(art::NodePtr& ref, std::span<std::byte const> k, ChunkPosition position, std::size_t depth,
+                     KeyArena& arena) -> bool
+  {
+    if (ref == nullptr) {
+      ref = art::makeLeaf(arena.store(k), position);
+      return true;
+    }
+    if (ref->kind == art::NodeKind::Leaf) {
+      auto leaf = art::asLeaf(ref.get());
+      auto leafKey = leaf->key.view();
+      if (compareKeys(leafKey, k) == 0) {
+        leaf->position = PackedPosition(position);
+        return false;
+      }
+      auto common = depth;
+      while (common < leafKey.size() && common < k.size() && leafKey[common] == k[common]) {
+        common++;
+      }
+      auto node = art::NodePtr(new art::Node4());
+      art::asInner(node.get())->prefix.assign(k.begin() + depth, k.begin() + common);
+      place(node, std::move(ref), common);
+      place(node, art::makeLeaf(arena.store(k), position), common);
+      ref = std::move(node);
+      return true;
+    }
+    auto inner = art::asInner(ref.get());
+    auto matched = art::matchPrefix(inner, k, depth);
+    if (matched < inner->prefix.size()) {
+      // the key leaves the prefix early, split it at the first differing byte
+      auto parent = art::NodePtr(new art::Node4());
+      art::asInner(parent.get())->prefix.assign(inner->prefix.begin(), inner->prefix.begin() + matched);
+      auto byte = std::to_integer<std::uint8_t>(inner->prefix[matched]);
+      inner->prefix.erase(inner->prefix.begin(), inner->prefix.begin() + matched + 1);
+      art::addChild(parent, byte, std::move(ref));
+      place(parent, art::makeLeaf(arena.store(k), position), depth + matched);
+      ref = std::move(parent);
+      return true;
+    }
+    depth += inner->prefix.size();
+    if (depth == k.size()) {
+      if (inner->value != nullptr) {
+        art::asLeaf(inner->value.get())->position = PackedPosition(position);
+        return false;
+      }
+      inner->value = art::makeLeaf(arena.store(k), position);
+      return true;
+    }
+    if (auto child = art::findChild(inner, art::byteAt(k, depth)); child != nullptr) {
+      return insert(*child, k, position, depth + 1, arena);
+    }
+    art::addChild(ref, art::byteAt(k, depth), art::makeLeaf(arena.store(k), position));
+    return true;
+  }
+  // hang a leaf below `node` whose prefix ends at `depth`
+  static auto place(art::NodePtr& node, art::NodePtr leaf, std::size_t depth) -> void
+  {
+    auto key = art::asLeaf(leaf.get())->key.view();
+    if (key.size() == depth) {
+      art::asInner(node.get())->value = std::move(leaf);
+    } else {
+      art::addChild(node, art::byteAt(key, depth), std::move(leaf));
+    }
+  }
+  static auto erase(art::NodePtr& ref, std::span<std::byte const> key, std::size_t depth, KeyArena& arena)
+      -> std::optional<ChunkPosition>
+  {
+    if (ref == nullptr) {
+      return std::nullopt;
+    }
+    if (ref->kind == art::NodeKind::Leaf) {
+      auto leaf = art::asLeaf(ref.get());
+      if (compareKeys(leaf->key.view(), key) != 0) {
+        return std::nullopt;
+      }
+      auto position = leaf->position.unpack();
+      arena.release(leaf->key);
+      ref.reset();
+      return position;
+    }
+    auto inner = art::asInner(ref.get());
+    if (art::matchPrefix(inner, key, depth) != inner->prefix.size()) {
+      return std::nullopt;
+    }
+    depth += inner->prefix.size();
+    if (depth == key.size()) {
+      if (inner->value == nullptr) {
+        return std::nullopt;
+      }
+      auto position = art::asLeaf(inner->value.get())->position.unpack();
+      arena.release(art::asLeaf(inner->value.get())->key);
+      inner->value.reset();
+      art::normalize(ref);
+      return position;
+    }
+    auto byte = art::byteAt(key, depth);
+    auto child = art::findChild(inner, byte);
+    if (child == nullptr) {
+      return std::nullopt;
+    }
+    auto position = erase(*child, key, depth + 1, arena);
+    if (position.has_value() && *child == nullptr) {
+      art::removeChild(ref, byte);
+    }
+    return position;
+  }
+
+  // call `fn(node)` for every node below and including `node`, inner nodes before their children
+  template <typename Fn>
+  static auto forEachNode(art::Node const* node, Fn&& fn) -> void
+  {
+    fn(node);
+    if (node->kind == art::NodeKind::Leaf) {
+      return;
+    }
+    auto inner = art::asInner(node);
+    if (inner->value != nullptr) {
+      fn(inner->value.get());
+    }
+    art::forEachChild(inner, false, [&](std::uint8_t, art::Node const* child) {
+      forEachNode(child, fn);
+      return true;
+    });
+  }
+  template <typename Fn>
+  static auto visitAll(art::Node const* node, bool reverse, Fn& fn) -> bool
+  {
+    if (node->kind == art::NodeKind::Leaf) {
+      auto leaf = art::asLeaf(node);
+      return fn(leaf->key.view(), leaf->position.unpack());
+    }
+    auto inner = art::asInner(node);
+    if (!reverse && inner->value != nullptr && !visitAll(inner->value.get(), reverse, fn)) {
+      return false;
+    }
+    if (!art::forEachChild(inner, reverse,
+                           [&](std::uint8_t, art::Node const* child) { return visitAll(child, reverse, fn); })) {
+      return false;
+    }
+    return !reverse || inner->value == nullptr || visitAll(inner->value.get(), reverse, fn);
+  }
+  // visit the keys >= `low` below `node` in ascending order, `bounded` is false when all of them are
+  template <typename Fn>
+  static auto ascendFrom(art::Node const* node, std::span<std::byte const> low, std::size_t depth, bool bounded,
+                         Fn& fn) -> bool
+  {
+    if (!bounded) {
+      return visitAll(node, false, fn);
+    }
+    if (node->kind == art::NodeKind::Leaf) {
+      auto leaf = art::asLeaf(node);
+      return compareKeys(leaf->key.view(), low) < 0 || fn(leaf->key.view(), leaf->position.unpack());
+    }
+    auto inner = art::asInner(node);
+    for (auto i = std::size_t(0); i < inner->prefix.size(); i++) {
+      // keys below that run past `low` or are larger at this byte all follow it
+      if (depth + i >= low.size() || inner->prefix[i] > low[depth + i]) {
+        return visitAll(node, false, fn);
+      }
+      if (inner->prefix[i] < low[depth + i]) {
+        return true;
+      }
+    }
+    depth += inner->prefix.size();
+    if (depth == low.size()) {
+      return visitAll(node, false, fn);
+    }
+    // the key ending here is a proper prefix of `low` and smaller than it
+    auto byte = art::byteAt(low, depth);
+    return art::forEachChild(inner, false, [&](std::uint8_t b, art::Node const* child) {
+      return b < byte || ascendFrom(child, low, depth + 1, b == byte, fn);
+    });
+  }
+  // visit the keys < `high` below `node` in descending order, `bounded` is false when all of them are
+  template <typename Fn>
+  static auto descendBelow(art::Node const* node, std::span<std::byte const> high, std::size_t depth, bool bounded,
+                           Fn& fn) -> bool
+  {
+    if (!bounded) {
+      return visitAll(node, true, fn);
+    }
+    if (node->kind == art::NodeKind::Leaf) {
+      auto leaf = art::asLeaf(node);
+      return compareKeys(leaf->key.view(), high) >= 0 || fn(leaf->key.view(), leaf->position.unpack());
+    }
+    auto inner = art::asInner(node);
+    for (auto i = std::size_t(0); i < inner->prefix.size(); i++) {
+      // keys below that run past `high` or are larger at this byte all follow it
+      if (depth + i >= high.size() || inner->prefix[i] > high[depth + i]) {
+        return true;
+      }
+      if (inner->prefix[i] < high[depth + i]) {
+        return visitAll(node, true, fn);
+      }
+    }
+    depth += inner->prefix.size();
+    if (depth == high.size()) {
+      return true;
+    }
+    auto byte = art::byteAt(high, depth);
+    if (!art::forEachChild(inner, true, [&](std::uint8_t b, art::Node const* child) {
+          return b > byte || descendBelow(child, high, depth + 1, b == byte, fn);
+        })) {
+      return false;
+    }
+    return inner->value == nullptr || visitAll(inner->value.get(), true, fn);
+  }
+
+  art::NodePtr mRoot;
+  std::size_t mSize = 0;
+  KeyArena mArena;
+  std::size_t mKeyBytes = 0;
+};
@@ -18,20 +18,37 @@ auto Batch::reset() -> void
   mPendingWrites.clear();
   mDB = nullptr;
 }
+// every batch holds the database shared so files are not swapped under it, write batches also
+// exclude each other until their append. readers never wait for writers, the index locks itself.
 auto Batch::lockDB() -> void
 {
-  if (mOption.readOnly) {
+  if (!mOption.readOnly) {
+    mDB->mWriteMt.lock();
+    mPriorBatches = mDB->mIssuedBatches;
+    mCaughtUp = false;
+  }
+  mDB->mMt.lock_shared();
+}
+// the batches before a write batch release `mWriteMt` once appended, they may still wait in the group
+// commit for their apply. a write batch reads the index only once they are done, or it would miss
+// their writes. `mMt` is let go meanwhile, their commits may wait for a merge or close that wants it.
+auto Batch::awaitPriorBatches() -> void
+{
+  if (mOption.readOnly || mCaughtUp) {
+    return;
+  }
+  if (!mDB->batchesFinished(mPriorBatches)) {
+    mDB->mMt.unlock_shared();
+    mDB->waitForBatches(mPriorBatches);
     mDB->mMt.lock_shared();
-  } else {
-    mDB->mMt.lock();
   }
+  mCaughtUp = true;
 }
 auto Batch::unlockDB() -> void
 {
-  if (mOption.readOnly) {
-    mDB->mMt.unlock_shared();
-  } else {
-    mDB->mMt.unlock();
+  mDB->mMt.unlock_shared();
+  if (!mOption.readOnly) {
+    mDB->mWriteMt.unlock();
   }
 }
 auto Batch::put(Bytes key, Bytes value) -> std::error_code
@@ -52,11 +69,16 @@ auto Batch::put(Bytes key, Bytes value) -> std::error_code
 
   return DbErr::Ok;
 }
-auto Batch::get(Bytes key) -> ext::expected<Bytes, std::error_code>
+auto Batch::put(BytesView key, BytesView value) -> std::error_code
 {
-  if (key.capacity() == 0) {
+  return put(Bytes::from(key.span()), Bytes::from(value.span()));
+}
+auto Batch::get(BytesView key) -> ext::expected<Bytes, std::error_code>
+{
+  if (key.empty()) {
     return ext::make_unexpected(DbErr::KeyEmpty);
   }
+  awaitPriorBatches();
   if (mDB->isClosed()) {
     return ext::make_unexpected(DbErr::DBClosed);
   }
@@ -72,48 +94,43 @@ auto Batch::get(Bytes key) -> ext::expected<Bytes, std::error_code>
       }
     }
   }
-  auto chunkPos = mDB->mIndexer.getPtr(key);
-  if (chunkPos == nullptr) {
-    return ext::make_unexpected(DbErr::KeyNotFound);
-  }
-  auto chunk = mDB->mDataFiles->read(*chunkPos);
-  if (!chunk.has_value()) {
-    return ext::make_unexpected(chunk.error());
-  }
-
-  auto record = LogRecord(chunk->span());
-  if (record.type() == LogRecordType::Delted) {
-    throw std::runtime_error("Deleted record found in data file");
-  }
-  return record.value();
+  return mDB->lookup(key);
 }
-auto Batch::del(Bytes key) -> std::error_code
+auto Batch::del(BytesView key) -> std::error_code
 {
-  if (key.capacity() == 0) {
+  if (key.empty()) {
     return DbErr::KeyEmpty;
   }
-  if (mDB->isClosed()) {
-    return DbErr::DBClosed;
-  }
   if (mOption.readOnly) {
     return DbErr::ReadOnlyBatch;
   }
+  awaitPriorBatches();
+  if (mDB->isClosed()) {
+    return DbErr::DBClosed;
+  }
 
+  auto exists = false;
+  mDB->readIndex([&] { exists = mDB->mIndexer.contains(key); });
   mMt.lock();
-  if (auto pos = mDB->mIndexer.getPtr(key); pos != nullptr) {
-    mPendingWrites[key] = std::make_unique<LogRecord>(key, Bytes(), LogRecordType::Delted, 0);
-  } else {
-    mPendingWrites.erase(key);
+  auto it = mPendingWrites.find(key);
+  if (exists) {
+    if (it == mPendingWrites.end()) {
+      it = mPendingWrites.emplace(Bytes::from(key.span()), nullptr).first;
+    }
+    it->second = std::make_unique<LogRecord>(it->first, Bytes(), LogRecordType::Delted, 0);
+  } else if (it != mPendingWrites.end()) {
+    mPendingWrites.erase(it);
   }
   mMt.unlock();
 
   return DbErr::Ok;
 };
-auto Batch::exist(Bytes key) -> ext::expected<bool, std::error_code>
+auto Batch::exist(BytesView key) -> ext::expected<bool, std::error_code>
 {
-  if (key.capacity() == 0) {
+  if (key.empty()) {
     return ext::make_unexpected(DbErr::KeyEmpty);
   }
+  awaitPriorBatches();
   if (mDB->isClosed()) {
     return ext::make_unexpected(DbErr::DBClosed);
   }
@@ -129,8 +146,9 @@ auto Batch::exist(Bytes key) -> ext::expected<bool, std::error_code>
       }
     }
   }
-  auto pos = mDB->mIndexer.getPtr(key);
-  return pos != nullptr;
+  auto exists = false;
+  mDB->readIndex([&] { exists = mDB->mIndexer.contains(key); });
+  return exists;
 };
 auto Batch::commit() -> std::error_code
 {
@@ -156,44 +174,53 @@ auto Batch::commit() -> std::error_code
     }
 
     auto batchID = mBatchID.gen();
-    auto positions = std::unordered_map<Bytes, ChunkPosition, BytesHash>();
-
+    // the whole batch is encoded back to back into one buffer that is reused across commits
+    thread_local auto buffer = std::vector<std::byte>();
+    auto total = kLogRecordHeaderSize + sizeof(batchID.id);
     for (auto const& [k, record] : mPendingWrites) {
-      record->setBatchID(batchID.id);
-      auto recordBytes = record->asBytes();
-      auto pos = mDB->mDataFiles->write(recordBytes.span());
-      if (!pos.has_value()) {
-        unlockDB();
-        return pos.error();
-      }
-      positions.emplace(record->key(), *pos);
-    }
-
-    auto endRecord = LogRecord(Bytes::from(batchID), Bytes(), LogRecordType::Finished, 0);
-    if (auto pos = mDB->mDataFiles->write(endRecord.asBytes().span()); !pos.has_value()) {
-      unlockDB();
-      return pos.error();
+      total += record->encodedSize();
     }
+    buffer.resize(total);
 
-    if (mOption.syncWrite && !mDB->mOption.syncWrite) {
-      auto err = mDB->mDataFiles->sync();
-      if (err) {
-        unlockDB();
-        return err;
-      }
+    auto records = std::vector<std::span<std::byte const>>();
+    records.reserve(mPendingWrites.size() + 1);
+    auto dst = std::span(buffer);
+    for (auto const& [k, record] : mPendingWrites) {
+      record->setBatchID(batchID.id);
+      auto n = record->encodeTo(dst);
+      records.push_back(dst.first(n));
+      dst = dst.subspan(n);
     }
+    auto n = LogRecord::encode(dst, LogRecordType::Finished, 0, std::span<std::byte const>(batchID), {});
+    records.push_back(dst.first(n));
 
-    for (auto const& [k, record] : mPendingWrites) {
-      if (record->type() == LogRecordType::Delted) {
-        mDB->mIndexer.del(k);
-      } else {
-        mDB->mIndexer.put(k, positions[k]);
+    // the append and fsync happen outside the database lock so concurrent committers can share them,
+    // the index is updated by the group commit leader in the same order the batches hit the log.
+    mDB->mIssuedBatches++;
+    unlockDB();
+    auto finished = Defer([&] { mDB->finishBatch(); });
+    auto apply = Wal::ApplyFn([&](std::span<ChunkPosition const> positions) {
+      // applies run one at a time, readers retry while the sequence is odd
+      auto applyLock = std::scoped_lock(mDB->mApplyMt);
+      mDB->mApplySeq.fetch_add(1);
+      auto applied = Defer([&] { mDB->mApplySeq.fetch_add(1); });
+      auto i = std::size_t(0);
+      for (auto const& [k, record] : mPendingWrites) {
+        if (record->type() == LogRecordType::Delted) {
+          mDB->mIndexer.del(k);
+        } else {
+          mDB->mIndexer.put(k, positions[i]);
+        }
+        i++;
+        // TODO watch queue
       }
-
-      // TODO watch queue
+    });
+    auto sync = mOption.syncWrite && !mDB->mOption.syncWrite;
+    auto filesLock = std::shared_lock(mDB->mFilesMt);
+    if (auto positions = mDB->mDataFiles->writeBatch(records, sync, apply); !positions.has_value()) {
+      return positions.error();
     }
     mCommitted = true;
-    unlockDB();
     return DbErr::Ok;
   }
 };
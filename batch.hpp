@@ -19,18 +19,25 @@ public:
   auto lockDB() -> void;
   auto unlockDB() -> void;
   auto put(Bytes key, Bytes value) -> std::error_code;
-  auto get(Bytes key) -> ext::expected<Bytes, std::error_code>;
-  auto del(Bytes key) -> std::error_code;
-  auto exist(Bytes key) -> ext::expected<bool, std::error_code>;
+  // copies the key and the value
+  auto put(BytesView key, BytesView value) -> std::error_code;
+  auto get(BytesView key) -> ext::expected<Bytes, std::error_code>;
+  auto del(BytesView key) -> std::error_code;
+  auto exist(BytesView key) -> ext::expected<bool, std::error_code>;
   auto commit() -> std::error_code;
   auto rollback() -> std::error_code;
 
 private:
+  auto awaitPriorBatches() -> void;
+
   Database* mDB = nullptr;
-  std::unordered_map<Bytes, std::unique_ptr<LogRecord>, BytesHash> mPendingWrites;
+  std::unordered_map<Bytes, std::unique_ptr<LogRecord>, BytesHash, BytesEqual> mPendingWrites;
   std::shared_mutex mMt;
   snowflake::Node mBatchID;
   BatchOption mOption;
   bool mCommitted;
   bool mRollbacked;
+  // write batches handed to the log before this one, and whether they are all applied
+  std::uint64_t mPriorBatches = 0;
+  bool mCaughtUp = false;
 };
\ No newline at end of file
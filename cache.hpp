@@ -1,16 +1,38 @@
 #pragma once
+#include "option.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstdint>
+#include <functional>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <unordered_map>
+#include <variant>
+#include <vector>
 
 template <typename K, typename V>
 struct KVPair {
   K key;
   V value;
+  std::size_t weight;
 };
 
-template <typename K, typename V>
+// every entry counts as one, capacities are entry counts
+struct UnitWeigher {
+  static constexpr std::size_t kTypicalWeight = 1;
+  template <typename V>
+  static auto weigh(V const&) -> std::size_t
+  {
+    return 1;
+  }
+};
+
+// capacities are in units of `W::weigh(value)`, by default entry counts
+template <typename K, typename V, typename W = UnitWeigher>
 class Cache {
 public:
   explicit Cache(std::size_t capacity = 64, std::size_t elasticity = 10) : mCapacity(capacity), mElasticity(elasticity)
@@ -24,23 +46,29 @@ public:
 
   auto size() const -> std::size_t { return mCache.size(); }
   auto capacity() const -> std::size_t { return mCapacity; }
+  auto weight() const -> std::size_t { return mWeight; }
   auto empty() const -> bool { return mCache.empty(); }
   auto clear() -> void
   {
     mCache.clear();
     mIndex.clear();
+    mWeight = 0;
   }
 
   auto put(K&& key, V&& value) -> std::size_t
   {
+    auto const weight = W::weigh(value);
     auto const it = mIndex.find(key);
     if (it != mIndex.end()) {
+      mWeight = mWeight - it->second->weight + weight;
       it->second->value = std::move(value);
+      it->second->weight = weight;
       mCache.splice(mCache.begin(), mCache, it->second);
-      return 0;
+      return prune();
     }
-    mCache.emplace_front(key, std::move(value));
+    mCache.emplace_front(key, std::move(value), weight);
     mIndex[key] = mCache.begin();
+    mWeight += weight;
     return prune();
   }
 
@@ -53,6 +81,12 @@ public:
     mCache.splice(mCache.begin(), mCache, it->second);
     return &it->second->value;
   }
+  // look up without changing the eviction order
+  auto peek(K const& key) const -> V const*
+  {
+    auto const it = mIndex.find(key);
+    return it == mIndex.end() ? nullptr : &it->second->value;
+  }
 
   auto remove(K const& key) -> std::optional<V>
   {
@@ -61,6 +95,7 @@ public:
       return std::nullopt;
     }
     auto value = std::move(it->second->value);
+    mWeight -= it->second->weight;
     mCache.erase(it->second);
     mIndex.erase(it);
     return value;
@@ -72,11 +107,12 @@ private:
   auto prune() -> std::size_t
   {
     auto maxAllowed = mCapacity + mElasticity;
-    if (mCapacity == 0 || mIndex.size() <= maxAllowed) {
+    if (mCapacity == 0 || mWeight <= maxAllowed) {
       return 0;
     }
     std::size_t count = 0;
-    while (mIndex.size() > mCapacity) {
+    while (mWeight > mCapacity) {
+      mWeight -= mCache.back().weight;
       mIndex.erase(mCache.back().key);
       mCache.pop_back();
       ++count;
@@ -85,7 +121,376 @@ private:
   }
   std::list<KVPair<K, V>> mCache;
   std::unordered_map<K, typename decltype(mCache)::iterator> mIndex;
+  std::size_t mWeight = 0;
 
   const std::size_t mCapacity;
   const std::size_t mElasticity;
-};
\ No newline at end of file
+};
+
+// approximate access counts in 4 rows of saturating counters, halved every `10 * width` increments
+// so the counts follow the recent workload.
+class FrequencySketch {
+public:
+  explicit FrequencySketch(std::size_t capacity)
+      : mWidth(std::bit_ceil(std::max<std::size_t>(capacity * 4, 64))), mSampleSize(mWidth * 10)
+  {
+    for (auto& row : mRows) {
+      row.assign(mWidth, 0);
+    }
+  }
+
+  auto increment(std::uint64_t hash) -> void
+  {
+    for (auto i = std::size_t(0); i < kDepth; i++) {
+      auto& counter = mRows[i][indexOf(hash, i)];
+      if (counter < kMaxCount) {
+        counter++;
+      }
+    }
+    if (++mAdditions >= mSampleSize) {
+      for (auto& row : mRows) {
+        for (auto& counter : row) {
+          counter >>= 1;
+        }
+      }
+      mAdditions /= 2;
+    }
+  }
+  auto frequency(std::uint64_t hash) const -> std::uint8_t
+  {
+    auto ret = kMaxCount;
+    for (auto i = std::size_t(0); i < kDepth; i++) {
+      ret = std::min(ret, mRows[i][indexOf(hash, i)]);
+    }
+    return ret;
+  }
+  auto clear() -> void
+  {
+    for (auto& row : mRows) {
+      std::fill(row.begin(), row.end(), 0);
+    }
+    mAdditions = 0;
+  }
+
+private:
+  static constexpr std::size_t kDepth = 4;
+  static constexpr std::uint8_t kMaxCount = 15;
+  static constexpr std::array<std::uint64_t, kDepth> kSeeds = {0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full,
+                                                              0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull};
+
+  auto indexOf(std::uint64_t hash, std::size_t row) const -> std::size_t
+  {
+    auto h = (hash + kSeeds[row]) * kSeeds[row];
+    return (h >> 32) & (mWidth - 1);
+  }
+
+  std::array<std::vector<std::uint8_t>, kDepth> mRows;
+  std::size_t mWidth;
+  std::size_t mSampleSize;
+  std::size_t mAdditions = 0;
+};
+
+// W-TinyLFU: new entries land in a small LRU window, and an entry evicted from the window only
+// enters the segmented LRU main area if it has been accessed more often than the entry it would
+// evict. a one-time scan therefore passes through the window without flushing the hot entries.
+template <typename K, typename V, typename W = UnitWeigher>
+class TinyLfuCache {
+public:
+  explicit TinyLfuCache(std::size_t capacity = 64, std::size_t elasticity = 0)
+      : mCapacity(capacity), mWindowCapacity(std::min(std::max(capacity / 100, W::kTypicalWeight), capacity)),
+        mProtectedCapacity((capacity - mWindowCapacity) * 4 / 5), mSketch(capacity / W::kTypicalWeight)
+  {
+  }
+  TinyLfuCache(TinyLfuCache const& other) = delete;
+  TinyLfuCache(TinyLfuCache&& other) = delete;
+  TinyLfuCache& operator=(TinyLfuCache&& other) = delete;
+  TinyLfuCache& operator=(TinyLfuCache const& other) = delete;
+  ~TinyLfuCache() = default;
+
+  auto size() const -> std::size_t { return mIndex.size(); }
+  auto capacity() const -> std::size_t { return mCapacity; }
+  auto weight() const -> std::size_t { return mWeights[Window] + mWeights[Probation] + mWeights[Protected]; }
+  auto empty() const -> bool { return mIndex.empty(); }
+  auto clear() -> void
+  {
+    for (auto& list : mLists) {
+      list.clear();
+    }
+    mWeights = {};
+    mIndex.clear();
+    mSketch.clear();
+  }
+
+  auto put(K&& key, V&& value) -> std::size_t
+  {
+    auto const weight = W::weigh(value);
+    if (auto it = mIndex.find(key); it != mIndex.end()) {
+      auto& entry = it->second;
+      mWeights[entry.region] = mWeights[entry.region] - entry.iter->weight + weight;
+      entry.iter->value = std::move(value);
+      entry.iter->weight = weight;
+      touch(entry);
+      return prune();
+    }
+    auto& window = mLists[Window];
+    window.emplace_front(key, std::move(value), weight);
+    mIndex[key] = Entry{Window, window.begin()};
+    mWeights[Window] += weight;
+    return prune();
+  }
+
+  auto get(K const& key) -> V*
+  {
+    mSketch.increment(hashOf(key));
+    auto it = mIndex.find(key);
+    if (it == mIndex.end()) {
+      return nullptr;
+    }
+    touch(it->second);
+    return &it->second.iter->value;
+  }
+  // look up without recording an access
+  auto peek(K const& key) const -> V const*
+  {
+    auto it = mIndex.find(key);
+    return it == mIndex.end() ? nullptr : &it->second.iter->value;
+  }
+
+  auto remove(K const& key) -> std::optional<V>
+  {
+    auto it = mIndex.find(key);
+    if (it == mIndex.end()) {
+      return std::nullopt;
+    }
+    auto value = std::move(it->second.iter->value);
+    mWeights[it->second.region] -= it->second.iter->weight;
+    mLists[it->second.region].erase(it->second.iter);
+    mIndex.erase(it);
+    return value;
+  }
+
+  auto contains(K const& key) const -> bool { return mIndex.find(key) != mIndex.end(); }
+
+private:
+  enum Region : std::uint8_t { Window, Probation, Protected };
+  using List = std::list<KVPair<K, V>>;
+  struct Entry {
+    Region region;
+    typename List::iterator iter;
+  };
+
+  static auto hashOf(K const& key) -> std::uint64_t { return std::hash<K>()(key); }
+
+  auto move(Entry& entry, Region to) -> void
+  {
+    mWeights[entry.region] -= entry.iter->weight;
+    mWeights[to] += entry.iter->weight;
+    mLists[to].splice(mLists[to].begin(), mLists[entry.region], entry.iter);
+    entry.region = to;
+  }
+  auto touch(Entry& entry) -> void
+  {
+    if (entry.region != Probation) {
+      move(entry, entry.region);
+      return;
+    }
+    move(entry, Protected);
+    while (mWeights[Protected] > mProtectedCapacity) {
+      move(mIndex.find(mLists[Protected].back().key)->second, Probation);
+    }
+  }
+  auto evict(Region region) -> void
+  {
+    mWeights[region] -= mLists[region].back().weight;
+    mIndex.erase(mLists[region].back().key);
+    mLists[region].pop_back();
+  }
+  // entries leaving the window compete with the main area's next victim, then the main area is
+  // trimmed back to the capacity
+  auto prune() -> std::size_t
+  {
+    if (mCapacity == 0) {
+      return 0;
+    }
+    auto count = std::size_t(0);
+    while (mWeights[Window] > mWindowCapacity && mLists[Window].size() > 1) {
+      auto& candidate = mIndex.find(mLists[Window].back().key)->second;
+      auto victimRegion = mLists[Probation].empty() ? Protected : Probation;
+      if (weight() <= mCapacity || mLists[victimRegion].empty()) {
+        move(candidate, Probation);
+        continue;
+      }
+      auto const& victim = mLists[victimRegion].back().key;
+      if (mSketch.frequency(hashOf(candidate.iter->key)) > mSketch.frequency(hashOf(victim))) {
+        evict(victimRegion);
+        move(candidate, Probation);
+      } else {
+        evict(Window);
+      }
+      count++;
+    }
+    while (weight() > mCapacity) {
+      auto region = !mLists[Probation].empty() ? Probation : !mLists[Protected].empty() ? Protected : Window;
+      evict(region);
+      count++;
+    }
+    return count;
+  }
+
+  std::array<List, 3> mLists;
+  std::array<std::size_t, 3> mWeights = {};
+  std::unordered_map<K, Entry> mIndex;
+  std::size_t const mCapacity;
+  std::size_t const mWindowCapacity;
+  std::size_t const mProtectedCapacity;
+  FrequencySketch mSketch;
+};
+
+struct CacheStats {
+  std::uint64_t hits = 0;
+  std::uint64_t misses = 0;
+  std::uint64_t evictions = 0;
+};
+
+constexpr std::size_t kDefaultCacheShards = 16;
+
+// `Cache` or `TinyLfuCache` split into independently locked shards, so concurrent readers only contend
+// when their keys land in the same shard. values are returned by copy since a pointer would outlive
+// the shard lock.
+template <typename K, typename V, typename W = UnitWeigher>
+class ShardedCache {
+public:
+  explicit ShardedCache(std::size_t capacity = 64, std::size_t elasticity = 10,
+                        std::size_t shards = kDefaultCacheShards, CachePolicy policy = CachePolicy::Lru)
+      : mCapacity(capacity)
+  {
+    // every shard should at least fit one typical entry
+    auto const count = std::clamp<std::size_t>(shards, 1, std::max<std::size_t>(capacity / W::kTypicalWeight, 1));
+    mShards.reserve(count);
+    for (auto i = std::size_t(0); i < count; i++) {
+      mShards.push_back(
+          std::make_unique<Shard>(policy, (capacity + count - 1) / count, (elasticity + count - 1) / count));
+    }
+  }
+  ShardedCache(ShardedCache const& other) = delete;
+  ShardedCache(ShardedCache&& other) = delete;
+  ShardedCache& operator=(ShardedCache&& other) = delete;
+  ShardedCache& operator=(ShardedCache const& other) = delete;
+  ~ShardedCache() = default;
+
+  auto size() const -> std::size_t
+  {
+    auto total = std::size_t(0);
+    for (auto const& shard : mShards) {
+      auto lk = std::scoped_lock(shard->mutex);
+      total += std::visit([](auto& c) { return c.size(); }, shard->cache);
+    }
+    return total;
+  }
+  auto capacity() const -> std::size_t { return mCapacity; }
+  // total weight of the cached entries
+  auto weight() const -> std::size_t
+  {
+    auto total = std::size_t(0);
+    for (auto const& shard : mShards) {
+      auto lk = std::scoped_lock(shard->mutex);
+      total += std::visit([](auto& c) { return c.weight(); }, shard->cache);
+    }
+    return total;
+  }
+  auto shardCount() const -> std::size_t { return mShards.size(); }
+  auto empty() const -> bool { return size() == 0; }
+  auto clear() -> void
+  {
+    for (auto& shard : mShards) {
+      auto lk = std::scoped_lock(shard->mutex);
+      std::visit([](auto& c) { c.clear(); }, shard->cache);
+    }
+  }
+
+  auto put(K const& key, V value) -> void
+  {
+    auto& shard = shardOf(key);
+    auto lk = std::scoped_lock(shard.mutex);
+    shard.stats.evictions += std::visit([&](auto& c) { return c.put(K(key), std::move(value)); }, shard.cache);
+  }
+
+  auto get(K const& key) -> std::optional<V>
+  {
+    auto& shard = shardOf(key);
+    auto lk = std::scoped_lock(shard.mutex);
+    auto value = std::visit([&](auto& c) { return c.get(key); }, shard.cache);
+    if (value == nullptr) {
+      shard.stats.misses++;
+      return std::nullopt;
+    }
+    shard.stats.hits++;
+    return *value;
+  }
+
+  // like `get`, but the entry is neither promoted nor counted as an access by the eviction policy
+  auto peek(K const& key) const -> std::optional<V>
+  {
+    auto& shard = shardOf(key);
+    auto lk = std::scoped_lock(shard.mutex);
+    auto value = std::visit([&](auto const& c) { return c.peek(key); }, shard.cache);
+    if (value == nullptr) {
+      shard.stats.misses++;
+      return std::nullopt;
+    }
+    shard.stats.hits++;
+    return *value;
+  }
+
+  auto remove(K const& key) -> std::optional<V>
+  {
+    auto& shard = shardOf(key);
+    auto lk = std::scoped_lock(shard.mutex);
+    return std::visit([&](auto& c) { return c.remove(key); }, shard.cache);
+  }
+
+  auto contains(K const& key) const -> bool
+  {
+    auto& shard = shardOf(key);
+    auto lk = std::scoped_lock(shard.mutex);
+    return std::visit([&](auto const& c) { return c.contains(key); }, shard.cache);
+  }
+
+  // counters of every shard, in shard order
+  auto stats() const -> std::vector<CacheStats>
+  {
+    auto ret = std::vector<CacheStats>();
+    ret.reserve(mShards.size());
+    for (auto const& shard : mShards) {
+      auto lk = std::scoped_lock(shard->mutex);
+      ret.push_back(shard->stats);
+    }
+    return ret;
+  }
+
+private:
+  struct Shard {
+    Shard(CachePolicy policy, std::size_t capacity, std::size_t elasticity)
+    {
+      if (policy == CachePolicy::TinyLfu) {
+        cache.template emplace<TinyLfuCache<K, V, W>>(capacity);
+      } else {
+        cache.template emplace<Cache<K, V, W>>(capacity, elasticity);
+      }
+    }
+
+    mutable std::mutex mutex;
+    std::variant<Cache<K, V, W>, TinyLfuCache<K, V, W>> cache;
+    CacheStats stats;
+  };
+
+  auto shardOf(K const& key) const -> Shard&
+  {
+    // keys such as block numbers are dense, mix the hash so neighbours spread over the shards
+    auto hash = std::uint64_t(std::hash<K>()(key)) * 0x9E3779B97F4A7C15ull;
+    return *mShards[(hash >> 32) % mShards.size()];
+  }
+
+  std::vector<std::unique_ptr<Shard>> mShards;
+  const std::size_t mCapacity;
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "crc32.hpp"
+#include "encoding.hpp"
+#include "file.hpp"
+#include "indexer.hpp"
+#include "wal.hpp"
+
+#include <array>
+#include <optional>
+
+// magic(8) + segment id(4) + offset(8) + key count(8), then for every key: key size(4) + the packed
+// position(12) + key, and last a crc32c of all bytes before it. the key count is taken before the keys
+// are written and only sizes the index on load, the entries run up to the crc.
+constexpr auto kCheckpointMagic = std::array<char, 8>{'N', 'P', 'I', 'D', 'X', 'C', 'P', '2'};
+constexpr std::size_t kCheckpointHeaderSize = 28;
+constexpr std::size_t kCheckpointEntryHeaderSize = 16;
+constexpr std::size_t kCheckpointIoBufferSize = 4 * MiB;
+
+struct IndexCheckpoint {
+  Indexer index;
+  // the index holds every record of the log before this position
+  WalPosition position;
+};
+
+// write `index` to `path`, through a temporary file that is synced and renamed over it once complete.
+// the index may be updated while it is written: an entry newer than `position` is harmless, the log
+// from there is replayed on load anyway. `log` is synced before the rename, so no entry points past
+// the durable end of the log.
+inline auto writeIndexCheckpoint(std::filesystem::path const& path, Indexer const& index, WalPosition const& position,
+                                 Wal& log) -> std::error_code
+{
+  auto tmpPath = std::filesystem::path(path) += ".tmp";
+  auto file = File::open(tmpPath, "wb", kCheckpointIoBufferSize);
+  if (!file) {
+    return make_error_code(file.error());
+  }
+  auto crc = std::uint32_t(0);
+  auto ok = true;
+  auto write = [&](std::span<std::byte const> bytes) {
+    crc = crc32c(bytes, crc);
+    ok = ok && file->write(bytes).has_value();
+  };
+
+  auto header = std::array<std::byte, kCheckpointHeaderSize>();
+  enc::put(header, kCheckpointMagic);
+  enc::put(std::span(header).subspan(8), position.mSegmentID);
+  enc::put(std::span(header).subspan(12), position.mOffset);
+  enc::put(std::span(header).subspan(20), std::uint64_t(index.size()));
+  write(header);
+  index.forEach([&](std::span<std::byte const> key, ChunkPosition const& pos) {
+    auto entry = std::array<std::byte, kCheckpointEntryHeaderSize>();
+    auto packed = PackedPosition(pos);
+    enc::put(entry, std::uint32_t(key.size()));
+    enc::put(std::span(entry).subspan(4), packed.mLow);
+    enc::put(std::span(entry).subspan(8), packed.mHigh);
+    enc::put(std::span(entry).subspan(12), packed.mChunkSize);
+    write(entry);
+    write(key);
+  });
+  auto trailer = std::array<std::byte, 4>();
+  enc::put(trailer, crc);
+  ok = ok && file->write(trailer).has_value();
+
+  if (auto err = log.sync(); err) {
+    file->close();
+    std::filesystem::remove(tmpPath);
+    return err;
+  }
+  if (!ok || file->sync() != std::errc(0) || !file->close()) {
+    std::filesystem::remove(tmpPath);
+    return make_error_code(std::errc::io_error);
+  }
+  auto ec = std::error_code();
+  std::filesystem::rename(tmpPath, path, ec);
+  return ec;
+}
+
+// read the checkpoint at `path` into an index of `type`, nullopt if there is none or it is damaged. the
+// index is built with the size it had when the checkpoint was taken reserved up front, so loading
+// rarely rehashes.
+inline auto loadIndexCheckpoint(std::filesystem::path const& path, IndexType type) -> std::optional<IndexCheckpoint>
+{
+  auto ec = std::error_code();
+  auto fileSize = std::uint64_t(std::filesystem::file_size(path, ec));
+  if (ec || fileSize < kCheckpointHeaderSize + 4) {
+    return std::nullopt;
+  }
+  auto file = File::open(path, "rb", kCheckpointIoBufferSize);
+  if (!file) {
+    return std::nullopt;
+  }
+  auto crc = std::uint32_t(0);
+  auto read = [&](std::span<std::byte> bytes) {
+    if (bytes.empty()) {
+      return true;
+    }
+    if (auto n = file->read(bytes); !n || *n != 1) {
+      return false;
+    }
+    crc = crc32c(bytes, crc);
+    return true;
+  };
+
+  auto header = std::array<std::byte, kCheckpointHeaderSize>();
+  if (!read(header) || std::memcmp(header.data(), kCheckpointMagic.data(), kCheckpointMagic.size()) != 0) {
+    return std::nullopt;
+  }
+  auto checkpoint = IndexCheckpoint{.index = Indexer(type)};
+  auto count = std::uint64_t();
+  enc::get(std::span(header).subspan(8), checkpoint.position.mSegmentID);
+  enc::get(std::span(header).subspan(12), checkpoint.position.mOffset);
+  enc::get(std::span(header).subspan(20), count);
+  // nothing is verified before the crc at the end, a damaged count or key size must not make the load
+  // allocate more than the file could hold
+  auto left = fileSize - kCheckpointHeaderSize - 4;
+  checkpoint.index.reserve(std::min(count, left / kCheckpointEntryHeaderSize));
+  // the index copies every key, they are all read into the same buffer
+  auto key = std::vector<std::byte>();
+  while (left > 0) {
+    auto entry = std::array<std::byte, kCheckpointEntryHeaderSize>();
+    if (!read(entry)) {
+      return std::nullopt;
+    }
+    auto keySize = std::uint32_t();
+    auto packed = PackedPosition();
+    enc::get(entry, keySize);
+    enc::get(std::span(entry).subspan(4), packed.mLow);
+    enc::get(std::span(entry).subspan(8), packed.mHigh);
+    enc::get(std::span(entry).subspan(12), packed.mChunkSize);
+    if (left < kCheckpointEntryHeaderSize + keySize) {
+      return std::nullopt;
+    }
+    left -= kCheckpointEntryHeaderSize + keySize;
+    key.resize(keySize);
+    if (!read(key)) {
+      return std::nullopt;
+    }
+    checkpoint.index.put(std::span<std::byte const>(key), packed.unpack());
+  }
+  auto expected = crc;
+  auto trailer = std::array<std::byte, 4>();
+  if (!read(trailer)) {
+    return std::nullopt;
+  }
+  auto stored = std::uint32_t();
+  enc::get(trailer, stored);
+  if (stored != expected) {
+    return std::nullopt;
+  }
+  return checkpoint;
+}
@@ -1,9 +1,16 @@
 #pragma once
+#include <array>
+#include <bit>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <span>
 
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
 static uint32_t crc32_tab[] = {
     0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL, 0x076dc419L, 0x706af48fL, 0xe963a535L, 0x9e6495a3L, 0x0edb8832L,
     0x79dcb8a4L, 0xe0d5e91eL, 0x97d2d988L, 0x09b64c2bL, 0x7eb17cbdL, 0xe7b82d07L, 0x90bf1d91L, 0x1db71064L, 0x6ab020f2L,
@@ -48,4 +55,90 @@ inline constexpr auto crc32(std::byte const* s, std::size_t len, std::uint32_t i
 inline constexpr auto crc32(std::span<std::byte const> s, std::uint32_t init = 0xFFFFFFFF) -> std::uint32_t
 {
   return crc32(s.data(), s.size(), init);
-}
\ No newline at end of file
+}
+
+namespace detail {
+constexpr std::uint32_t kCrc32cPoly = 0x82F63B78;
+
+// table k maps a byte to its crc32c contribution k bytes further down the stream
+constexpr auto makeCrc32cTables() -> std::array<std::array<std::uint32_t, 256>, 8>
+{
+  auto tables = std::array<std::array<std::uint32_t, 256>, 8>();
+  for (std::uint32_t i = 0; i < 256; i++) {
+    auto crc = i;
+    for (auto bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) != 0 ? (crc >> 1) ^ kCrc32cPoly : crc >> 1;
+    }
+    tables[0][i] = crc;
+  }
+  for (std::size_t i = 0; i < 256; i++) {
+    for (std::size_t k = 1; k < 8; k++) {
+      tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xFF];
+    }
+  }
+  return tables;
+}
+inline constexpr auto kCrc32cTables = makeCrc32cTables();
+
+// slicing-by-8, `crc` is the running value without the final inversion
+inline auto crc32cSoftware(std::byte const* s, std::size_t len, std::uint32_t crc) -> std::uint32_t
+{
+  auto const& t = kCrc32cTables;
+  auto byte = [&](std::byte b) { crc = t[0][(crc ^ std::to_integer<std::uint32_t>(b)) & 0xFF] ^ (crc >> 8); };
+  if constexpr (std::endian::native == std::endian::little) {
+    for (; len >= 8; s += 8, len -= 8) {
+      std::uint64_t word;
+      std::memcpy(&word, s, 8);
+      auto lo = std::uint32_t(word) ^ crc;
+      auto hi = std::uint32_t(word >> 32);
+      crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^ t[3][hi & 0xFF] ^
+            t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+  }
+  for (; len > 0; s++, len--) {
+    byte(*s);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline auto crc32cHardware(std::byte const* s, std::size_t len, std::uint32_t crc)
+    -> std::uint32_t
+{
+  auto crc64 = std::uint64_t(crc);
+  for (; len >= 8; s += 8, len -= 8) {
+    std::uint64_t word;
+    std::memcpy(&word, s, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = std::uint32_t(crc64);
+  for (; len > 0; s++, len--) {
+    crc = _mm_crc32_u8(crc, std::to_integer<std::uint8_t>(*s));
+  }
+  return crc;
+}
+
+inline auto hasSse42() -> bool
+{
+  static bool const supported = __builtin_cpu_supports("sse4.2");
+  return supported;
+}
+#endif
+} // namespace detail
+
+/* crc32c (castagnoli) hash, uses the sse4.2 crc32 instruction when the cpu has it. chained calls with
+ * the previous result as `init` give the hash of the concatenated input */
+inline auto crc32c(std::byte const* s, std::size_t len, std::uint32_t init = 0) -> std::uint32_t
+{
+#if defined(__x86_64__)
+  if (detail::hasSse42()) {
+    return ~detail::crc32cHardware(s, len, ~init);
+  }
+#endif
+  return ~detail::crc32cSoftware(s, len, ~init);
+}
+
+inline auto crc32c(std::span<std::byte const> s, std::uint32_t init = 0) -> std::uint32_t
+{
+  return crc32c(s.data(), s.size(), init);
+}
@@ -1,10 +1,15 @@
 #include "db.hpp"
 #include <iostream>
+#include <optional>
+#include <set>
+#include <thread>
 
 auto loadMergeFiles(std::filesystem::path const& dir) -> std::error_code;
-auto loadIndexFromWAL(DbOption const& opt, Wal& datafile, Indexer& indexer, std::error_code& ec) -> void;
+auto loadIndexFromWAL(DbOption const& opt, Wal& datafile, Indexer& indexer, std::error_code& ec,
+                      WalPosition const& from = {}) -> void;
+static auto loadCheckpoint(DbOption const& opt, Wal& datafile) -> std::optional<IndexCheckpoint>;
 auto openMergeFinishedFile(DbOption const& opt) -> ext::expected<std::unique_ptr<Wal>, std::error_code>;
-static auto loadIndexFromHintFile(DbOption const& opt, Indexer& indexer, std::error_code& ec) -> std::unique_ptr<Wal>;
+static auto loadIndexFromHintFile(DbOption const& opt, Indexer& indexer) -> std::error_code;
 static auto openWALFiles(DbOption const& opt, std::error_code& ec) -> std::unique_ptr<Wal>;
 auto openMergeDB(DbOption const& option) -> std::unique_ptr<Database>;
 
@@ -29,30 +34,52 @@ auto Database::open(DbOption const& opt) -> ext::expected<std::unique_ptr<Databa
   if (dataFiles == nullptr) {
     return ext::make_unexpected(ec);
   }
-  auto indexer = Indexer();
+  auto indexer = Indexer(opt.indexType);
 
   if (ec = loadMergeFiles(opt.dirPath); ec) {
     return ext::make_unexpected(ec);
   }
 
-  auto hintFile = loadIndexFromHintFile(opt, indexer, ec);
-  if (hintFile == nullptr) {
-    return ext::make_unexpected(ec);
+  // a checkpoint already holds the merge hints and every record before its position
+  auto checkpoint = loadCheckpoint(opt, *dataFiles);
+  auto from = WalPosition();
+  if (checkpoint.has_value()) {
+    indexer = std::move(checkpoint->index);
+    from = checkpoint->position;
+  }
+  if (!checkpoint.has_value()) {
+    if (ec = loadIndexFromHintFile(opt, indexer); ec) {
+      return ext::make_unexpected(ec);
+    }
   }
 
   ec = std::error_code();
-  loadIndexFromWAL(opt, *dataFiles.get(), indexer, ec);
+  loadIndexFromWAL(opt, *dataFiles.get(), indexer, ec, from);
   if (ec) {
     return ext::make_unexpected(ec);
   }
 
-  return std::make_unique<Database>(opt, std::move(dataFiles), std::move(hintFile), std::move(indexer),
-                                    std::move(lockFile).value(), false);
+  auto db = std::make_unique<Database>(opt, std::move(dataFiles), nullptr, std::move(indexer),
+                                       std::move(lockFile).value(), false);
+  db->startHintWriter();
+  db->startCheckpointer();
+  return db;
+}
+Database::~Database()
+{
+  stopCheckpointer();
+  closeFiles();
 }
-Database::~Database() { closeFiles(); }
 auto Database::close() -> void
 {
+  stopCheckpointer();
+  auto filesLock = std::scoped_lock(mFilesMt);
   auto lk = std::scoped_lock(mMt);
+  if (mOption.indexCheckpoint && !mClosed) {
+    if (auto err = writeCheckpoint(mDataFiles->endPosition()); err) {
+      log_error("write index checkpoint failed: %s\n", err.message().c_str());
+    }
+  }
   closeFiles();
   auto r = mLockFile.unlock();
   assert(r == std::errc(0));
@@ -70,6 +97,11 @@ auto Database::stat() -> DatabaseStat
   // );
   throw std::runtime_error("not implemented");
 }
+auto Database::memoryStat() -> IndexMemoryStat
+{
+  auto lk = std::shared_lock(mMt);
+  return mIndexer.memoryStat();
+}
 auto Database::put(Bytes key, Bytes value) -> std::error_code
 {
   auto batch = newBatch({false, false});
@@ -83,14 +115,13 @@ auto Database::put(Bytes key, Bytes value) -> std::error_code
 
 auto Database::closeFiles() -> void
 {
+  stopHintWriter();
   if (mDataFiles) {
     auto ok = mDataFiles->close();
     assert(ok);
   }
-  if (mHintFile) {
-    auto ok = mHintFile->close();
-    assert(ok);
-  }
+  // a merge hint file that was never finished has no footer and is not loaded
+  mHintFile.reset();
 }
 
 auto openWALFiles(DbOption const& opt, std::error_code& ec) -> std::unique_ptr<Wal>
@@ -100,8 +131,14 @@ auto openWALFiles(DbOption const& opt, std::error_code& ec) -> std::unique_ptr<W
       .segmentSize = opt.segmentSize,
       .segmentFileExt = std::string(kDataFileNameSuffix),
       .blockCache = opt.blockCache,
+      .cachePolicy = opt.cachePolicy,
+      .checksumMode = opt.checksumMode,
       .syncWrite = opt.syncWrite,
       .bytesPerSync = opt.bytesPerSync,
+      .mmapSealedSegments = opt.mmapSealedSegments,
+      .ioType = opt.ioType,
+      .writeBufferSize = opt.writeBufferSize,
+      .flushInterval = opt.flushInterval,
   });
   if (wal.has_value()) {
     return std::move(wal).value();
@@ -119,15 +156,120 @@ auto Database::newBatch(BatchOption opt) -> std::unique_ptr<Batch>
                                              });
   return batch;
 }
-auto Database::get(Bytes key) -> ext::expected<Bytes, std::error_code>
+auto Database::batchesFinished(std::uint64_t count) -> bool
 {
-  auto batch = newBatch({false, true});
-  auto ret = batch->get(key);
-  auto r = batch->commit();
-  assert(!r);
-  return ret;
+  auto lk = std::scoped_lock(mFinishedMt);
+  return mFinishedBatches >= count;
+}
+auto Database::waitForBatches(std::uint64_t count) -> void
+{
+  auto lk = std::unique_lock(mFinishedMt);
+  mFinishedCv.wait(lk, [&] { return mFinishedBatches >= count; });
+}
+auto Database::finishBatch() -> void
+{
+  {
+    auto lk = std::scoped_lock(mFinishedMt);
+    mFinishedBatches++;
+  }
+  mFinishedCv.notify_all();
+}
+auto Database::newIterator(IteratorOption option) -> ext::expected<std::unique_ptr<Iterator>, std::error_code>
+{
+  // `mMt` keeps the segments the index points into open. commits still append to the log while the
+  // index is copied, only their apply waits for `mApplyMt`, so the copy holds whole batches.
+  auto lk = std::shared_lock(mMt);
+  if (isClosed()) {
+    return ext::make_unexpected(DbErr::DBClosed);
+  }
+  auto applyLock = std::unique_lock(mApplyMt);
+  auto keys = KeyArena();
+  auto entries = std::vector<Iterator::Entry>();
+  auto ids = std::set<SegmentID>();
+  entries.reserve(mIndexer.size());
+  mIndexer.forEach([&](std::span<std::byte const> key, ChunkPosition const& position) {
+    entries.push_back(Iterator::Entry{keys.store(key), PackedPosition(position)});
+    if (!option.keyOnly) {
+      ids.insert(position.mSegmentID);
+    }
+  });
+  applyLock.unlock();
+  auto segments = std::map<SegmentID, std::shared_ptr<Segment>>();
+  for (auto id : ids) {
+    segments.emplace(id, mDataFiles->segment(id));
+  }
+  return std::make_unique<Iterator>(std::move(keys), std::move(entries), std::move(segments), option);
+}
+auto Database::put(BytesView key, BytesView value) -> std::error_code
+{
+  return put(Bytes::from(key.span()), Bytes::from(value.span()));
+}
+// a read needs no batch, it only holds the database shared like a read-only batch would
+auto Database::get(BytesView key) -> ext::expected<Bytes, std::error_code>
+{
+  if (key.empty()) {
+    return ext::make_unexpected(DbErr::KeyEmpty);
+  }
+  auto lk = std::shared_lock(mMt);
+  if (isClosed()) {
+    return ext::make_unexpected(DbErr::DBClosed);
+  }
+  return lookup(key);
 };
-auto Database::del(Bytes key) -> std::error_code
+auto Database::lookup(BytesView key) -> ext::expected<Bytes, std::error_code>
+{
+  auto chunkPos = std::optional<ChunkPosition>();
+  readIndex([&] { chunkPos = mIndexer.get(key); });
+  if (!chunkPos.has_value()) {
+    return ext::make_unexpected(DbErr::KeyNotFound);
+  }
+  auto chunk = mDataFiles->read(*chunkPos);
+  if (!chunk.has_value()) {
+    return ext::make_unexpected(chunk.error());
+  }
+
+  auto record = LogRecord(chunk->span());
+  if (record.type() == LogRecordType::Delted) {
+    throw std::runtime_error("Deleted record found in data file");
+  }
+  return record.value();
+}
+auto Database::multiGet(std::vector<Bytes> const& keys) -> std::vector<ext::expected<Bytes, std::error_code>>
+{
+  auto lk = std::shared_lock(mMt);
+  auto results = std::vector<ext::expected<Bytes, std::error_code>>(keys.size());
+  auto positions = std::vector<ChunkPosition>();
+  auto found = std::vector<std::size_t>();
+  // all keys are looked up between the same two batches
+  readIndex([&] {
+    positions.clear();
+    found.clear();
+    for (auto i = std::size_t(0); i < keys.size(); i++) {
+      if (keys[i].capacity() == 0) {
+        results[i] = ext::make_unexpected(make_error_code(DbErr::KeyEmpty));
+      } else if (isClosed()) {
+        results[i] = ext::make_unexpected(make_error_code(DbErr::DBClosed));
+      } else if (auto pos = mIndexer.get(keys[i]); !pos.has_value()) {
+        results[i] = ext::make_unexpected(make_error_code(DbErr::KeyNotFound));
+      } else {
+        positions.push_back(*pos);
+        found.push_back(i);
+      }
+    }
+  });
+
+  auto chunks = mDataFiles->readMany(positions);
+  for (auto i = std::size_t(0); i < found.size(); i++) {
+    if (!chunks[i]) {
+      results[found[i]] = ext::make_unexpected(chunks[i].error());
+      continue;
+    }
+    auto record = LogRecord(chunks[i]->span());
+    results[found[i]] = record.value();
+  }
+  return results;
+}
+auto Database::del(BytesView key) -> std::error_code
 {
   auto batch = newBatch({false, false});
   if (auto r = batch->del(key); r != DbErr::Ok) {
@@ -136,15 +278,111 @@ auto Database::del(Bytes key) -> std::error_code
   }
   return batch->commit();
 };
-auto Database::exist(Bytes key) -> ext::expected<bool, std::error_code>
+auto Database::exist(BytesView key) -> ext::expected<bool, std::error_code>
 {
-  auto batch = newBatch({false, true});
-  auto res = batch->exist(key);
-  auto e = batch->commit();
-  assert(e.value() == 0);
-  return res;
+  if (key.empty()) {
+    return ext::make_unexpected(DbErr::KeyEmpty);
+  }
+  auto lk = std::shared_lock(mMt);
+  if (isClosed()) {
+    return ext::make_unexpected(DbErr::DBClosed);
+  }
+  auto exists = false;
+  readIndex([&] { exists = mIndexer.contains(key); });
+  return exists;
 };
 
+// positions a scan collects from the index at a time, writers only wait for one batch of them
+constexpr std::size_t kScanBatchSize = 256;
+
+// the smallest key after every key that starts with `prefix`, empty if there is none
+static auto prefixEnd(Bytes const& prefix) -> Bytes
+{
+  auto span = prefix.span();
+  auto n = span.size();
+  while (n > 0 && span[n - 1] == std::byte(0xff)) {
+    n--;
+  }
+  if (n == 0) {
+    return Bytes();
+  }
+  auto end = Bytes::from(span.first(n));
+  end.span()[n - 1] = std::byte(std::to_integer<std::uint8_t>(span[n - 1]) + 1);
+  return end;
+}
+
+// `mMt` is only held while a batch of keys and values is collected, `fn` runs without it so it may
+// write to the database
+auto Database::scan(ScanOption const& option, ScanFn const& fn) -> std::error_code
+{
+  if (!mIndexer.ordered()) {
+    return DbErr::IndexNotOrdered;
+  }
+  auto low = option.low;
+  auto high = option.high;
+  if (option.prefix.capacity() > 0) {
+    if (compareKeys(option.prefix.span(), low.span()) > 0) {
+      low = option.prefix;
+    }
+    auto end = prefixEnd(option.prefix);
+    if (end.capacity() > 0 && (high.capacity() == 0 || compareKeys(end.span(), high.span()) < 0)) {
+      high = end;
+    }
+  }
+
+  auto keys = std::vector<Bytes>();
+  auto positions = std::vector<ChunkPosition>();
+  auto collect = [&](std::span<std::byte const> key, ChunkPosition const& position) {
+    keys.push_back(Bytes::from(key));
+    positions.push_back(position);
+    return keys.size() < kScanBatchSize;
+  };
+  auto values = std::vector<Bytes>();
+  for (;;) {
+    {
+      auto lk = std::shared_lock(mMt);
+      if (isClosed()) {
+        return DbErr::DBClosed;
+      }
+      // the keys of one batch are collected between the same two commits
+      readIndex([&] {
+        keys.clear();
+        positions.clear();
+        if (option.reverse) {
+          mIndexer.descend(low, high, collect);
+        } else {
+          mIndexer.ascend(low, high, collect);
+        }
+      });
+      // the values are read without the index locked
+      auto chunks = mDataFiles->readMany(positions);
+      values.clear();
+      for (auto& chunk : chunks) {
+        if (!chunk) {
+          return chunk.error();
+        }
+        values.push_back(LogRecord(chunk->span()).value());
+      }
+    }
+    for (auto i = std::size_t(0); i < keys.size(); i++) {
+      if (!fn(keys[i], values[i])) {
+        return DbErr::Ok;
+      }
+    }
+    if (keys.size() < kScanBatchSize) {
+      return DbErr::Ok;
+    }
+    // go on right after the last key, the smallest key above it is itself followed by a zero byte
+    if (option.reverse) {
+      high = keys.back();
+    } else {
+      low = Bytes(keys.back().capacity() + 1);
+      std::copy_n(keys.back().data(), keys.back().capacity(), low.data());
+      low.data()[keys.back().capacity()] = std::byte(0);
+    }
+  }
+}
+
 auto mergeDirPath(std::filesystem::path const& dir) -> std::filesystem::path
 {
   auto parent = dir.parent_path();
@@ -152,33 +390,24 @@ auto mergeDirPath(std::filesystem::path const& dir) -> std::filesystem::path
   return parent / name += kMergeDirSuffixName;
 }
 
-auto encHintRecord(Bytes key, ChunkPosition const& pos) -> Bytes
-{
-  auto buf = Bytes(16 + key.capacity());
-  enc::put(buf.span(), std::span((std::byte*)&pos, 16));
-  enc::put(buf.span().subspan(16), key.span());
-  return buf;
-}
 auto getMergeFinSegmentId(std::filesystem::path const& mergePath) -> SegmentID
 {
   auto mergeFileName = segmentFileName(mergePath.native(), kMergeFinNameSuffix, 1);
   if (!std::filesystem::exists(mergeFileName)) {
     return 0;
   }
-  auto file = File::open(mergeFileName, "r");
-  if (!file) {
-    return 0;
-  }
-  auto buf = std::array<std::byte, 4>();
-  auto r = file->read(std::as_writable_bytes(std::span(buf)));
-  if (!r) {
+  // the finished file is written as a log, its first chunk holds the id
+  auto file = Segment(mergePath.native(), kMergeFinNameSuffix, 1, nullptr);
+  auto chunk = file.read(0, 0);
+  if (!chunk || chunk->capacity() < 4) {
     return 0;
   }
   auto segId = std::uint32_t();
-  enc::get(buf, segId);
+  enc::get(chunk->span(), segId);
   return segId;
 }
 
+// hint files written before the block format held one log chunk per key: the raw position then the key
 auto decHintRecord(std::span<std::byte const> bytes) -> std::pair<Bytes, ChunkPosition>
 {
   ChunkPosition pos;
@@ -212,18 +441,25 @@ auto loadMergeFiles(std::filesystem::path const& dir) -> std::error_code
   };
 
   auto mergeFinSegmentId = getMergeFinSegmentId(mergeDir);
+  // positions in the checkpoint point into the segments about to be replaced
+  std::filesystem::remove(dir / kCheckpointFileName);
   for (int fileId = 1; fileId <= mergeFinSegmentId; fileId++) {
     auto destFile = segmentFileName(dir.native(), kDataFileNameSuffix, fileId);
 
     if (std::filesystem::exists(destFile)) {
       std::filesystem::remove(destFile);
     }
+    // the hint of the replaced segment describes its old contents
+    std::filesystem::remove(segmentFileName(dir.native(), kSegmentHintFileNameSuffix, fileId));
 
     copyFile(kDataFileNameSuffix, fileId, false);
   }
 
-  copyFile(kHintFileNameSuffix, 1, true);
-  copyFile(kHintFileNameSuffix, 1, true);
+  // without the finished file the merge hint may be incomplete
+  if (mergeFinSegmentId > 0) {
+    copyFile(kHintFileNameSuffix, 1, true);
+  }
+  copyFile(kMergeFinNameSuffix, 1, true);
   std::filesystem::remove_all(mergeDir);
   return DbErr::Ok;
 }
@@ -237,6 +473,8 @@ auto Database::merge(bool reopenAfterDoen) -> std::error_code
     return DbErr::Ok;
   }
 
+  stopCheckpointer();
+  auto filesLock = std::scoped_lock(mFilesMt);
   auto lk = std::scoped_lock(mMt);
   closeFiles();
 
@@ -250,21 +488,27 @@ auto Database::merge(bool reopenAfterDoen) -> std::error_code
   }
   mDataFiles = std::move(dataFiles);
 
-  mHintFile = loadIndexFromHintFile(mOption, mIndexer, ec);
-  if (mHintFile == nullptr) {
+  if (ec = loadIndexFromHintFile(mOption, mIndexer); ec) {
     return ec;
   }
-  ec = std::error_code();
-  loadIndexFromWAL(mOption, *dataFiles, mIndexer, ec);
+  loadIndexFromWAL(mOption, *mDataFiles, mIndexer, ec);
   if (ec) {
     return ec;
   }
+  // the keys removed since open or the last merge are still in the index arenas
+  mIndexer.compact();
+  startHintWriter();
+  startCheckpointer();
 
   return DbErr::Ok;
 }
 
 auto Database::doMerge() -> std::error_code
 {
+  // commits hold `mFilesMt` from their append until they are applied to the index. none is in flight
+  // while the active segment is rotated, so every record in the segments merged below is already in
+  // the index and the merge reader does not skip it as stale.
+  auto filesLock = std::unique_lock(mFilesMt);
   mMt.lock();
   if (isClosed()) {
     mMt.unlock();
@@ -290,9 +534,12 @@ auto Database::doMerge() -> std::error_code
   }
 
   mMt.unlock();
+  filesLock.unlock();
   auto mergeDB = openMergeDB(mOption);
 
-  auto reader = mDataFiles->readerWithMax(prevActiveSegId);
+  // merge streams every block once, keep it out of the block cache
+  auto reader =
+      mDataFiles->readerWithMax(prevActiveSegId, ReadOption{.fillCache = false, .readahead = mOption.scanReadahead});
   for (;;) {
     auto pos = ChunkPosition();
     auto chunk = reader.next(pos);
@@ -304,10 +551,7 @@ auto Database::doMerge() -> std::error_code
     }
     auto record = LogRecord(chunk.value().span());
     if (record.type() == LogRecordType::Normal) {
-
-      mMt.lock_shared();
       auto idxPos = mIndexer.get(record.key());
-      mMt.unlock_shared();
 
       if (idxPos.has_value() && idxPos == pos) {
         record.setBatchID(kMergeFinishedBatchID);
@@ -315,16 +559,22 @@ auto Database::doMerge() -> std::error_code
         if (!newPos) {
           return newPos.error();
         }
-        auto hintRecord = encHintRecord(record.key(), newPos.value());
-        auto res = mergeDB->mHintFile->write(hintRecord.span());
-        if (!res) {
-          return res.error();
+        auto err = mergeDB->mHintFile->add(HintEntry{
+            .key = record.key().span(),
+            .position = newPos.value(),
+            .batchID = kMergeFinishedBatchID,
+        });
+        if (err) {
+          return err;
         }
       }
     }
   }
+  if (auto err = mergeDB->mHintFile->finish(); err) {
+    return err;
+  }
 
-  auto mergeFinFile = openMergeFinishedFile(mOption);
+  auto mergeFinFile = openMergeFinishedFile(mergeDB->getOption());
   if (!mergeFinFile) {
     throw std::runtime_error("failed to open merge db finished file");
   }
@@ -346,23 +596,19 @@ auto openMergeDB(DbOption const& option) -> std::unique_ptr<Database>
   if (std::filesystem::exists(mergePath)) {
     std::filesystem::remove_all(mergePath);
   }
+  std::filesystem::create_directories(mergePath);
   auto opt = option;
   opt.syncWrite = false;
   opt.bytesPerSync = 0;
+  opt.segmentHints = false;
+  opt.indexCheckpoint = false;
   opt.dirPath = mergePath;
 
   auto mergeDB = Database::open(opt);
   if (!mergeDB) {
     throw std::runtime_error("failed to open merge db");
   }
-  auto hintFile = Wal::create(WalOption{
-      .dirPath = opt.dirPath,
-      .segmentSize = std::numeric_limits<std::int64_t>().max(),
-      .segmentFileExt = std::string(kHintFileNameSuffix),
-      .blockCache = 0,
-      .syncWrite = false,
-      .bytesPerSync = 0,
-  });
+  auto hintFile = HintWriter::create(segmentFileName(opt.dirPath.native(), kHintFileNameSuffix, 1));
   if (!hintFile) {
     throw std::runtime_error("failed to open merge db hint file");
   }
@@ -383,19 +629,19 @@ auto openMergeFinishedFile(DbOption const& opt) -> ext::expected<std::unique_ptr
   return ret;
 }
 
-auto loadIndexFromHintFile(DbOption const& opt, Indexer& indexer, std::error_code& ec) -> std::unique_ptr<Wal>
+// load a merge hint file in the log chunk format
+static auto loadIndexFromLegacyHintFile(DbOption const& opt, Indexer& indexer) -> std::error_code
 {
   auto hintFile = Wal::create(WalOption{
       .dirPath = opt.dirPath,
       .segmentSize = std::numeric_limits<std::int64_t>().max(),
       .segmentFileExt = std::string(kHintFileNameSuffix),
-      .blockCache = 32 * KiB * 10,
+      .blockCache = 0,
   });
   if (!hintFile) {
-    ec = hintFile.error();
-    return nullptr;
+    return hintFile.error();
   }
-  auto reader = hintFile->get()->reader();
+  auto reader = hintFile->get()->reader(ReadOption{.fillCache = false, .readahead = opt.scanReadahead});
   for (;;) {
     auto pos = ChunkPosition();
     auto chunk = reader.next(pos);
@@ -403,73 +649,393 @@ auto loadIndexFromHintFile(DbOption const& opt, Indexer& indexer, std::error_cod
       if (chunk.error() == WalErr::EndOfSegments) {
         break;
       }
-      ec = chunk.error();
-      return nullptr;
+      return chunk.error();
     }
     auto [key, idxPos] = decHintRecord(chunk.value().span());
 
     indexer.put(key, idxPos);
   }
-  return std::move(hintFile).value();
+  auto ok = hintFile->get()->close();
+  assert(ok);
+  return DbErr::Ok;
+}
+
+// load the merge hint file into `indexer`
+auto loadIndexFromHintFile(DbOption const& opt, Indexer& indexer) -> std::error_code
+{
+  auto path = segmentFileName(opt.dirPath.native(), kHintFileNameSuffix, 1);
+  if (!std::filesystem::exists(path)) {
+    return DbErr::Ok;
+  }
+  auto reader = HintReader::open(path);
+  if (!reader) {
+    if (reader.error() == DbErr::InvalidHintFile) {
+      return loadIndexFromLegacyHintFile(opt, indexer);
+    }
+    return reader.error();
+  }
+  indexer.reserve(indexer.size() + reader->entryCount());
+  auto entry = HintEntry();
+  for (;;) {
+    auto more = reader->next(entry);
+    if (!more) {
+      return more.error();
+    }
+    if (!more.value()) {
+      return DbErr::Ok;
+    }
+    indexer.put(entry.key, entry.position);
+  }
+}
+
+// index records recovered from one segment: batches whose Finished marker is in the segment, in
+// marker order, and the records of batches still open at the end of the segment. Records written
+// by merge are visible without a marker and have no batch to complete.
+struct SegmentRecovery {
+  std::vector<std::pair<std::optional<std::uint64_t>, std::vector<IndexRecord>>> finished;
+  std::unordered_map<std::uint64_t, std::vector<IndexRecord>> pending;
+  std::error_code ec;
 };
 
-auto loadIndexFromWAL(DbOption const& opt, Wal& datafile, Indexer& indexer, std::error_code& ec) -> void
+static auto addIndexRecord(SegmentRecovery& result, LogRecordType type, std::uint64_t batchId, Bytes key,
+                           ChunkPosition const& pos, SegmentID mergeFinSegmentId) -> void
 {
-  auto mergeFinSegmentId = getMergeFinSegmentId(opt.dirPath);
-  auto indexRecords = std::unordered_map<std::uint64_t, std::vector<IndexRecord>>();
+  if (type == LogRecordType::Finished) {
+    std::uint64_t finishedId = 0;
+    enc::get(key.span(), finishedId);
+    auto node = result.pending.extract(finishedId);
+    result.finished.emplace_back(finishedId, node.empty() ? std::vector<IndexRecord>() : std::move(node.mapped()));
+  } else if (type == LogRecordType::Normal && batchId == mergeFinSegmentId) {
+    result.finished.emplace_back(std::nullopt, std::vector<IndexRecord>{IndexRecord{
+                                                   .mKey = std::move(key),
+                                                   .mType = type,
+                                                   .position = pos,
+                                               }});
+  } else {
+    result.pending[batchId].push_back(IndexRecord{
+        .mKey = std::move(key),
+        .mType = type,
+        .position = pos,
+    });
+  }
+}
 
-  auto reader = datafile.reader();
+// call `fn(header, key, position)` for every record of the segment, only the header and key of each
+// record are read and values are skipped. stops early once `fn` returns false.
+template <typename Fn>
+static auto forEachRecordHead(SegmentReader reader, Fn&& fn) -> std::error_code
+{
+  auto const measure = ChunkHeadFn(LogRecordHeader::measure);
   for (;;) {
-    auto readers = reader.readers();
-    auto currentReaderIdx = reader.currentReaderIdx();
-    auto const& currReader = readers[currentReaderIdx];
+    auto pos = ChunkPosition();
+    auto chunk = reader.nextHead(pos, measure);
+    if (!chunk) {
+      if (chunk.error() == SegmentErr::EndOfSegment) {
+        return DbErr::Ok;
+      }
+      return chunk.error();
+    }
+    auto span = chunk.value().span();
+    auto header = LogRecordHeader::decode(span);
+    if (!fn(header, span.subspan(kLogRecordHeaderSize, header.keySize), pos)) {
+      return DbErr::Ok;
+    }
+  }
+}
 
-    if (currReader.id() <= mergeFinSegmentId) {
-      reader.skipCurrentSegment();
+static auto scanSegmentForIndex(SegmentReader reader, SegmentID mergeFinSegmentId) -> SegmentRecovery
+{
+  auto result = SegmentRecovery();
+  result.ec = forEachRecordHead(reader, [&](LogRecordHeader const& header, std::span<std::byte const> key,
+                                            ChunkPosition const& pos) {
+    addIndexRecord(result, header.type, header.batchID, Bytes::from(key), pos, mergeFinSegmentId);
+    return true;
+  });
+  return result;
+}
+
+// write the hint file of a sealed segment under a temporary name and rename it once it is complete,
+// a hint file that exists always covers its whole segment
+static auto writeSegmentHint(DbOption const& opt, Segment& segment, std::atomic_bool const& stop) -> std::error_code
+{
+  auto dir = opt.dirPath.native();
+  auto tmpPath = segmentFileName(dir, kSegmentHintTmpFileNameSuffix, segment.id());
+  auto writer = HintWriter::create(tmpPath);
+  if (!writer) {
+    return writer.error();
+  }
+  auto addErr = std::error_code();
+  auto reader = segment.reader(ReadOption{.fillCache = false, .readahead = opt.scanReadahead});
+  auto err = forEachRecordHead(reader, [&](LogRecordHeader const& header, std::span<std::byte const> key,
+                                           ChunkPosition const& pos) {
+    addErr = writer.value()->add(HintEntry{.key = key, .position = pos, .type = header.type, .batchID = header.batchID});
+    return !addErr && !stop.load();
+  });
+  if (!err) {
+    err = addErr;
+  }
+  if (!err && !stop.load()) {
+    err = writer.value()->finish();
+  }
+  auto ec = std::error_code();
+  if (err || stop.load()) {
+    writer.value().reset();
+    std::filesystem::remove(tmpPath, ec);
+    return err;
+  }
+  std::filesystem::rename(tmpPath, segmentFileName(dir, kSegmentHintFileNameSuffix, segment.id()), ec);
+  return ec;
+}
+
+// the index records of a sealed segment from its hint file, nullopt if it has none or it can not be read.
+// an unreadable hint file is removed so the hint writer writes it again.
+static auto loadSegmentHint(DbOption const& opt, SegmentID id, SegmentID mergeFinSegmentId)
+    -> std::optional<SegmentRecovery>
+{
+  auto path = segmentFileName(opt.dirPath.native(), kSegmentHintFileNameSuffix, id);
+  if (!std::filesystem::exists(path)) {
+    return std::nullopt;
+  }
+  auto fail = [&](std::error_code const& err) {
+    log_error("segment hint %u is unreadable, scanning the segment: %s\n", id, err.message().c_str());
+    auto ec = std::error_code();
+    std::filesystem::remove(path, ec);
+  };
+  auto reader = HintReader::open(path);
+  if (!reader) {
+    fail(reader.error());
+    return std::nullopt;
+  }
+  auto result = SegmentRecovery();
+  auto entry = HintEntry();
+  for (;;) {
+    auto more = reader->next(entry);
+    if (!more) {
+      fail(more.error());
+      return std::nullopt;
+    }
+    if (!more.value()) {
+      return result;
+    }
+    addIndexRecord(result, entry.type, entry.batchID, Bytes::from(entry.key), entry.position, mergeFinSegmentId);
+  }
+}
+
+// the log before `from` is already in `indexer`
+auto loadIndexFromWAL(DbOption const& opt, Wal& datafile, Indexer& indexer, std::error_code& ec,
+                      WalPosition const& from) -> void
+{
+  auto mergeFinSegmentId = getMergeFinSegmentId(opt.dirPath);
+
+  auto readers = std::vector<SegmentReader>();
+  auto readOption = ReadOption{.fillCache = false, .readahead = opt.scanReadahead};
+  auto walReader = datafile.reader(readOption);
+  for (auto const& reader : walReader.readers()) {
+    if (reader.id() <= mergeFinSegmentId || reader.id() < from.mSegmentID) {
       continue;
     }
+    if (reader.id() == from.mSegmentID && from.mOffset > 0) {
+      // the bytes at the end of a block too short for a chunk are padding
+      auto blockNumber = std::uint32_t(from.mOffset / kBlockSize);
+      auto chunkOffset = from.mOffset % std::int64_t(kBlockSize);
+      if (chunkOffset + kChunkHeaderSize >= kBlockSize) {
+        blockNumber++;
+        chunkOffset = 0;
+      }
+      readers.push_back(SegmentReader(datafile.segment(reader.id()).get(), blockNumber, chunkOffset, readOption));
+      continue;
+    }
+    readers.push_back(reader);
+  }
 
-    auto pos = ChunkPosition();
-    auto chunk = reader.next(pos);
-    if (!chunk) {
-      if (chunk.error() == WalErr::EndOfSegments) {
-        break;
+  // segments are scanned concurrently, the results are applied in segment order below
+  // sealed segments are read from their hint file if they have one
+  auto activeSegmentId = datafile.activeSegmentID();
+  auto results = std::vector<SegmentRecovery>(readers.size());
+  auto threads = opt.recoveryThreads != 0 ? opt.recoveryThreads : std::thread::hardware_concurrency();
+  threads = std::clamp<std::size_t>(threads, 1, readers.size() == 0 ? 1 : readers.size());
+  auto next = std::atomic<std::size_t>(0);
+  auto scan = [&] {
+    for (auto i = next.fetch_add(1); i < readers.size(); i = next.fetch_add(1)) {
+      auto hinted = std::optional<SegmentRecovery>();
+      if (readers[i].id() != activeSegmentId && !(readers[i].id() == from.mSegmentID && from.mOffset > 0)) {
+        hinted = loadSegmentHint(opt, readers[i].id(), mergeFinSegmentId);
+      }
+      results[i] = hinted.has_value() ? std::move(hinted).value() : scanSegmentForIndex(readers[i], mergeFinSegmentId);
+    }
+  };
+  auto workers = std::vector<std::thread>();
+  for (std::size_t i = 1; i < threads; i++) {
+    workers.emplace_back(scan);
+  }
+  scan();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  auto apply = [&](std::vector<IndexRecord> const& records) {
+    for (auto const& indexRecord : records) {
+      if (indexRecord.mType == LogRecordType::Normal) {
+        indexer.put(indexRecord.mKey, indexRecord.position);
       }
-      ec = chunk.error();
+      if (indexRecord.mType == LogRecordType::Delted) {
+        indexer.del(indexRecord.mKey);
+      }
+    }
+  };
+  // records of batches whose Finished marker has not been seen yet, carried across segments
+  auto indexRecords = std::unordered_map<std::uint64_t, std::vector<IndexRecord>>();
+  for (auto& result : results) {
+    if (result.ec) {
+      ec = result.ec;
       return;
     }
-    auto record = LogRecord(chunk.value().span());
-    if (record.type() == LogRecordType::Finished) {
-      std::uint64_t batchId = 0;
-      enc::get(record.key().span(), batchId);
-      for (auto const& indexRecord : indexRecords[batchId]) {
-        if (indexRecord.mType == LogRecordType::Normal) {
-          indexer.put(indexRecord.mKey, indexRecord.position);
-        }
-        if (indexRecord.mType == LogRecordType::Delted) {
-          indexer.del(indexRecord.mKey);
-        }
+    for (auto const& [batchId, records] : result.finished) {
+      if (auto it = batchId ? indexRecords.find(*batchId) : indexRecords.end(); it != indexRecords.end()) {
+        apply(it->second);
+        indexRecords.erase(it);
       }
-      indexRecords.erase(batchId);
-    } else if (record.type() == LogRecordType::Normal && record.batchID() == mergeFinSegmentId) {
-      indexer.put(record.key(), pos);
-    } else {
-      indexRecords[record.batchID()].push_back(IndexRecord{
-          .mKey = record.key(),
-          .mType = record.type(),
-          .position = pos,
-      });
+      apply(records);
+    }
+    for (auto& [batchId, records] : result.pending) {
+      auto& carried = indexRecords[batchId];
+      carried.insert(carried.end(), std::make_move_iterator(records.begin()), std::make_move_iterator(records.end()));
     }
   }
-};
+}
 
-Database::Database(DbOption const& option, std::unique_ptr<Wal> dataFiles, std::unique_ptr<Wal> hintFile,
+Database::Database(DbOption const& option, std::unique_ptr<Wal> dataFiles, std::unique_ptr<HintWriter> hintFile,
                    Indexer indexer, File lockFile, bool closed) noexcept
     : mOption(option), mDataFiles(std::move(dataFiles)), mHintFile(std::move(hintFile)), mLockFile(std::move(lockFile)),
       mIndexer(std::move(indexer)), mClosed(closed)
 {
 }
-auto Database::setHintFile(std::unique_ptr<Wal> hintFile) -> void
+// the checkpoint in the database directory, if there is one that matches the log. one that does not,
+// because the log it was taken from lost its tail, is removed so later appends can not make it match,
+// and so is one left over while checkpoints are turned off.
+auto loadCheckpoint(DbOption const& opt, Wal& datafile) -> std::optional<IndexCheckpoint>
+{
+  auto path = opt.dirPath / kCheckpointFileName;
+  auto checkpoint = opt.indexCheckpoint ? loadIndexCheckpoint(path, opt.indexType) : std::nullopt;
+  if (checkpoint.has_value()) {
+    auto segment = datafile.segment(checkpoint->position.mSegmentID);
+    if (segment != nullptr && std::int64_t(segment->size()) >= checkpoint->position.mOffset) {
+      return checkpoint;
+    }
+    log_error("index checkpoint does not match the log, rebuilding the index\n");
+  }
+  std::filesystem::remove(path);
+  return std::nullopt;
+}
+
+auto Database::writeCheckpoint(WalPosition const& position) -> std::error_code
+{
+  return writeIndexCheckpoint(mOption.dirPath / kCheckpointFileName, mIndexer, position, *mDataFiles);
+}
+auto Database::checkpoint() -> std::error_code
+{
+  auto writing = std::scoped_lock(mCheckpointWriteMt);
+  // commits hold `mFilesMt` from their append until they are applied to the index, the end of the log
+  // read while none is in flight is a batch boundary that every record before it is applied up to.
+  // commits go on while the index is written.
+  auto filesLock = std::unique_lock(mFilesMt);
+  auto lk = std::shared_lock(mMt);
+  if (isClosed()) {
+    return DbErr::DBClosed;
+  }
+  auto position = mDataFiles->endPosition();
+  filesLock.unlock();
+  return writeCheckpoint(position);
+}
+auto Database::startCheckpointer() -> void
+{
+  if (!mOption.indexCheckpoint || mOption.checkpointInterval.count() == 0 || mCheckpointer.joinable()) {
+    return;
+  }
+  mCheckpointStop = false;
+  mCheckpointer = std::thread([this] {
+    auto lk = std::unique_lock(mCheckpointMutex);
+    while (!mCheckpointCv.wait_for(lk, mOption.checkpointInterval, [&] { return mCheckpointStop; })) {
+      lk.unlock();
+      if (auto err = checkpoint(); err) {
+        log_error("write index checkpoint failed: %s\n", err.message().c_str());
+      }
+      lk.lock();
+    }
+  });
+}
+auto Database::stopCheckpointer() -> void
+{
+  if (!mCheckpointer.joinable()) {
+    return;
+  }
+  {
+    auto lk = std::scoped_lock(mCheckpointMutex);
+    mCheckpointStop = true;
+  }
+  mCheckpointCv.notify_all();
+  mCheckpointer.join();
+}
+
+// hint files are written for segments sealed from now on, and for sealed segments that have none yet
+auto Database::startHintWriter() -> void
+{
+  if (!mOption.segmentHints || mHintWriter.joinable()) {
+    return;
+  }
+  auto mergeFinSegmentId = getMergeFinSegmentId(mOption.dirPath);
+  {
+    auto lk = std::scoped_lock(mHintMutex);
+    mHintStop = false;
+    for (auto id : mDataFiles->sealedSegmentIDs()) {
+      if (id > mergeFinSegmentId &&
+          !std::filesystem::exists(segmentFileName(mOption.dirPath.native(), kSegmentHintFileNameSuffix, id))) {
+        mHintQueue.push_back(id);
+      }
+    }
+  }
+  mDataFiles->setSealHandler([this](SegmentID id) {
+    auto lk = std::scoped_lock(mHintMutex);
+    mHintQueue.push_back(id);
+    mHintCv.notify_one();
+  });
+  mHintWriter = std::thread([this] { hintWriterLoop(); });
+}
+// a hint file left half written is finished after the next open
+auto Database::stopHintWriter() -> void
+{
+  if (!mHintWriter.joinable()) {
+    return;
+  }
+  mDataFiles->setSealHandler(nullptr);
+  {
+    auto lk = std::scoped_lock(mHintMutex);
+    mHintStop = true;
+    mHintQueue.clear();
+  }
+  mHintCv.notify_all();
+  mHintWriter.join();
+}
+auto Database::hintWriterLoop() -> void
+{
+  auto lk = std::unique_lock(mHintMutex);
+  for (;;) {
+    mHintCv.wait(lk, [&] { return mHintStop || !mHintQueue.empty(); });
+    if (mHintStop) {
+      break;
+    }
+    auto id = mHintQueue.front();
+    mHintQueue.pop_front();
+    lk.unlock();
+    if (auto segment = mDataFiles->segment(id); segment != nullptr) {
+      if (auto err = writeSegmentHint(mOption, *segment, mHintStop); err) {
+        log_error("write hint of segment %u failed: %s\n", id, err.message().c_str());
+      }
+    }
+    lk.lock();
+  }
+}
+auto Database::setHintFile(std::unique_ptr<HintWriter> hintFile) -> void
 {
   std::unique_lock lock(mMt);
   mHintFile = std::move(hintFile);
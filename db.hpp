@@ -1,16 +1,26 @@
 #pragma once
 
 #include "batch.hpp"
+#include "checkpoint.hpp"
+#include "hint.hpp"
 #include "file.hpp"
 #include "indexer.hpp"
+#include "iterator.hpp"
 #include "wal.hpp"
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <functional>
+#include <thread>
 
 using namespace std::literals;
 constexpr auto kFileLockName = "FLOCK"sv;
+constexpr auto kCheckpointFileName = "INDEX.CKPT"sv;
 constexpr auto kDataFileNameSuffix = ".SEG"sv;
 constexpr auto kHintFileNameSuffix = ".HINT"sv;
+constexpr auto kSegmentHintFileNameSuffix = ".SEGHINT"sv;
+constexpr auto kSegmentHintTmpFileNameSuffix = ".SEGHINT.tmp"sv;
 constexpr auto kMergeFinNameSuffix = ".MERGEFIN"sv;
 
 constexpr auto kMergeDirSuffixName = "-merge"sv;
@@ -18,14 +28,27 @@ constexpr auto kMergeFinishedBatchID = 0;
 
 auto mergeDirPath(std::filesystem::path const& dir) -> std::filesystem::path;
 
+// the keys a scan visits: those in [low, high) that start with `prefix`, an empty field does not restrict it
+struct ScanOption {
+  Bytes prefix;
+  Bytes low;
+  Bytes high;
+  bool reverse = false;
+};
+// called with every key and value of a scan in key order, returns false to stop the scan
+using ScanFn = std::function<bool(Bytes const& key, Bytes const& value)>;
+
 struct DatabaseStat {
   std::uint64_t keyCount;
   std::uint64_t diskSize;
 };
 
+// reads see every committed batch entirely or not at all: a get or exist sees a batch's keys
+// together, multiGet and each group of keys a scan collects see the same batches, so does the
+// snapshot of an iterator.
 class Database {
 public:
-  Database(DbOption const& option, std::unique_ptr<Wal> dataFiles, std::unique_ptr<Wal> hintFile, Indexer indexer,
+  Database(DbOption const& option, std::unique_ptr<Wal> dataFiles, std::unique_ptr<HintWriter> hintFile, Indexer indexer,
            File lockFile, bool closed) noexcept;
   ~Database();
   static auto open(DbOption const& option) -> ext::expected<std::unique_ptr<Database>, std::error_code>;
@@ -33,33 +56,99 @@ public:
   auto close() -> void;
   auto sync() -> std::error_code;
   auto stat() -> DatabaseStat;
+  // the memory the index takes for its keys and positions
+  auto memoryStat() -> IndexMemoryStat;
 
   auto put(Bytes key, Bytes value) -> std::error_code;
-  auto get(Bytes key) -> ext::expected<Bytes, std::error_code>;
-  auto del(Bytes key) -> std::error_code;
-  auto exist(Bytes key) -> ext::expected<bool, std::error_code>;
+  // copies the key and the value
+  auto put(BytesView key, BytesView value) -> std::error_code;
+  // looks the key up without allocating, only the value read is
+  auto get(BytesView key) -> ext::expected<Bytes, std::error_code>;
+  auto multiGet(std::vector<Bytes> const& keys) -> std::vector<ext::expected<Bytes, std::error_code>>;
+  auto del(BytesView key) -> std::error_code;
+  auto exist(BytesView key) -> ext::expected<bool, std::error_code>;
+  // visit keys in order, only with an ordered index (`IndexType::Art`)
+  auto scan(ScanOption const& option, ScanFn const& fn) -> std::error_code;
 
   auto newBatch(BatchOption opt) -> std::unique_ptr<Batch>;
+  // iterate a snapshot of the live keys, their values are read lazily from pinned segments
+  auto newIterator(IteratorOption option = {}) -> ext::expected<std::unique_ptr<Iterator>, std::error_code>;
   auto merge(bool reopenAfterDoen) -> std::error_code;
   auto isClosed() -> bool { return mClosed; }
   auto isMerging() -> bool { return mMerging.load(); }
   auto getOption() const -> DbOption const& { return mOption; }
 
-  auto setHintFile(std::unique_ptr<Wal> hintFile) -> void;
+  auto setHintFile(std::unique_ptr<HintWriter> hintFile) -> void;
+  // save the index with a log position to replay from, commits only wait while the position is read
+  auto checkpoint() -> std::error_code;
 
 private:
   friend class Batch;
 
   auto closeFiles() -> void;
+  // the value of `key` in the index and the log, the caller holds `mMt` shared
+  auto lookup(BytesView key) -> ext::expected<Bytes, std::error_code>;
+  // run `read` against the index until no batch was applied while it ran, so it sees every batch
+  // entirely or not at all. `read` must reset whatever it collects, it may run more than once.
+  template <typename Fn> auto readIndex(Fn&& read) -> void
+  {
+    for (;;) {
+      auto seq = mApplySeq.load();
+      if (seq % 2 == 0) {
+        read();
+        if (mApplySeq.load() == seq) {
+          return;
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
   auto doMerge() -> std::error_code;
+  // whether the first `count` write batches handed to the log have finished their commit
+  auto batchesFinished(std::uint64_t count) -> bool;
+  auto waitForBatches(std::uint64_t count) -> void;
+  auto finishBatch() -> void;
+  auto startHintWriter() -> void;
+  auto stopHintWriter() -> void;
+  auto hintWriterLoop() -> void;
+  // write the index, which holds every record of the log before `position`
+  auto writeCheckpoint(WalPosition const& position) -> std::error_code;
+  auto startCheckpointer() -> void;
+  auto stopCheckpointer() -> void;
 
 private:
   DbOption mOption;
   std::unique_ptr<Wal> mDataFiles;
-  std::unique_ptr<Wal> mHintFile;
+  std::unique_ptr<HintWriter> mHintFile;
+  // held shared by every batch, exclusively while the files are swapped or closed
   std::shared_mutex mMt;
+  // serializes write batches from their creation to their append
+  std::mutex mWriteMt;
+  // write batches handed to the log, counted under `mWriteMt`, and those whose commit returned
+  std::uint64_t mIssuedBatches = 0;
+  std::mutex mFinishedMt;
+  std::condition_variable mFinishedCv;
+  std::uint64_t mFinishedBatches = 0;
+  // held shared by commits appending to the log without `mMt`, exclusively while the files are swapped or closed
+  std::shared_mutex mFilesMt;
   std::atomic_bool mMerging;
   File mLockFile;
   Indexer mIndexer;
+  // odd while a batch is being applied to the index, see `readIndex`
+  std::atomic_uint64_t mApplySeq = 0;
+  // held by every apply and while an iterator copies the index, appends to the log go on meanwhile
+  std::mutex mApplyMt;
   bool mClosed = false;
+  // ids of sealed segments waiting for their hint file
+  std::mutex mHintMutex;
+  std::condition_variable mHintCv;
+  std::deque<SegmentID> mHintQueue;
+  std::atomic_bool mHintStop = false;
+  std::thread mHintWriter;
+  // one checkpoint is written at a time
+  std::mutex mCheckpointWriteMt;
+  std::mutex mCheckpointMutex;
+  std::condition_variable mCheckpointCv;
+  bool mCheckpointStop = false;
+  std::thread mCheckpointer;
 };
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <limits>
 #include <span>
@@ -84,4 +85,33 @@ auto get(auto const& buf, auto&& value) -> void
   auto n = std::min(src.size(), dst.size());
   copyNBytes<to, from>(dst.data(), src.data(), n);
 }
+
+// LEB128: 7 bits per byte, least significant group first, the high bit set on all but the last byte
+constexpr std::size_t kMaxVarintSize = 10;
+
+// encode `value` at the start of `buf`, which must hold `kMaxVarintSize` bytes, and return its length
+inline auto putVarint(std::span<std::byte> buf, std::uint64_t value) -> std::size_t
+{
+  auto n = std::size_t(0);
+  while (value >= 0x80) {
+    buf[n++] = std::byte(value | 0x80);
+    value >>= 7;
+  }
+  buf[n++] = std::byte(value);
+  return n;
+}
+
+// decode a varint from the start of `buf` and return its length, 0 if it is truncated or too long
+inline auto getVarint(std::span<std::byte const> buf, std::uint64_t& value) -> std::size_t
+{
+  value = 0;
+  for (auto i = std::size_t(0); i < std::min(buf.size(), kMaxVarintSize); i++) {
+    auto byte = std::to_integer<std::uint64_t>(buf[i]);
+    value |= (byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
 } // namespace enc
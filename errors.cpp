@@ -39,6 +39,10 @@ auto WalErrCatagory::message(int ev) const -> std::string
     return "EndOfSegments";
   case WalErr::InvalidOption:
     return "InvalidOption";
+  case WalErr::TooManySegments:
+    return "TooManySegments";
+  case WalErr::CommitFailed:
+    return "CommitFailed";
   default:
     return "Unknown";
   }
@@ -74,6 +78,12 @@ auto DbErrCatagory::message(int ev) const -> std::string
     return "MergeRunning";
   case DbErr::InvalidDbOption:
     return "InvalidDbOption";
+  case DbErr::InvalidHintFile:
+    return "InvalidHintFile";
+  case DbErr::IndexNotOrdered:
+    return "IndexNotOrdered";
+  case DbErr::KeyOnlyIterator:
+    return "KeyOnlyIterator";
   default:
     return "Unknown";
   }
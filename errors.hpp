@@ -22,6 +22,8 @@ enum class WalErr {
   InvalidCheckSum,
   EndOfSegments,
   InvalidOption,
+  TooManySegments,
+  CommitFailed,
 };
 struct WalErrCatagory : std::error_category {
   auto name() const noexcept -> char const* override;
@@ -42,6 +44,9 @@ enum class DbErr {
   DBClosed,
   MergeRunning,
   InvalidDbOption,
+  InvalidHintFile,
+  IndexNotOrdered,
+  KeyOnlyIterator,
 };
 struct DbErrCatagory : std::error_category {
   auto name() const noexcept -> char const* override;
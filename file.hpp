@@ -148,6 +148,7 @@ private:
 } // namespace stdc
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 namespace np_linux {
@@ -167,7 +168,7 @@ public:
   {
     if (mFd != -1) {
       auto r = ::close(mFd);
-      assert(r);
+      assert(r == 0);
     }
   }
 
@@ -187,12 +188,18 @@ public:
   }
   auto write(void const* ptr, std::size_t size) -> std::optional<std::size_t>
   {
-    auto n = ::write(mFd, ptr, size);
-    if (n == -1) {
-      return std::nullopt;
-    } else {
-      return n;
+    auto total = std::size_t(0);
+    while (total < size) {
+      auto n = ::write(mFd, (std::byte const*)ptr + total, size - total);
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return std::nullopt;
+      }
+      total += n;
     }
+    return total;
   }
   auto read(std::span<std::byte> bytes) -> std::optional<std::size_t> { return read(bytes.data(), bytes.size()); }
   auto read(void* ptr, std::size_t size) -> std::optional<std::size_t>
@@ -204,6 +211,26 @@ public:
       return n;
     }
   }
+  // positional read, does not touch the file offset so it is safe to call from many threads at once.
+  // returns the number of bytes read, which is less than `bytes.size()` only at end of file.
+  auto readAt(std::span<std::byte> bytes, std::int64_t offset) const -> std::optional<std::size_t>
+  {
+    auto total = std::size_t(0);
+    while (total < bytes.size()) {
+      auto n = ::pread64(mFd, bytes.data() + total, bytes.size() - total, offset + total);
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return std::nullopt;
+      }
+      if (n == 0) {
+        break;
+      }
+      total += n;
+    }
+    return total;
+  }
 
   auto seek(std::int64_t offset, int whence) -> std::errc
   {
@@ -236,6 +263,15 @@ public:
   }
 
   auto isClosed() const -> bool { return mFd == -1; }
+  auto fd() const -> int { return mFd; }
+  // hint the kernel how [offset, offset + length) will be accessed, length 0 means to the end of file
+  auto advise(std::int64_t offset, std::int64_t length, int advice) const -> std::errc
+  {
+    if (auto r = ::posix_fadvise64(mFd, offset, length, advice); r != 0) {
+      return std::errc(r);
+    }
+    return std::errc(0);
+  }
   auto rewind() -> decltype(auto) { return seek(0, SEEK_SET); }
   auto eof() -> bool { return ::lseek64(mFd, 0, SEEK_CUR) == ::lseek64(mFd, 0, SEEK_END); }
   auto cleareof() -> void {}
@@ -253,6 +289,55 @@ protected:
 private:
   int mFd = -1;
 };
+
+// read-only shared mapping of a file prefix
+class Mapping {
+public:
+  Mapping() = default;
+  Mapping(Mapping const&) = delete;
+  Mapping& operator=(Mapping const&) = delete;
+  Mapping(Mapping&& other) : mData(std::exchange(other.mData, nullptr)), mSize(std::exchange(other.mSize, 0)) {}
+  Mapping& operator=(Mapping&& other)
+  {
+    std::swap(mData, other.mData);
+    std::swap(mSize, other.mSize);
+    return *this;
+  }
+  ~Mapping()
+  {
+    if (mData != nullptr) {
+      auto r = ::munmap(mData, mSize);
+      assert(r == 0);
+    }
+  }
+
+  inline static auto map(File const& file, std::size_t size) -> ext::expected<Mapping, std::errc>
+  {
+    auto ptr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, file.fd(), 0);
+    if (ptr == MAP_FAILED) {
+      return ext::make_unexpected(std::errc(errno));
+    }
+    return Mapping(static_cast<std::byte*>(ptr), size);
+  }
+
+  auto data() const -> std::byte* { return mData; }
+  auto size() const -> std::size_t { return mSize; }
+  auto span() const -> std::span<std::byte const> { return {mData, mSize}; }
+  auto advise(int advice) -> std::errc
+  {
+    if (::madvise(mData, mSize, advice) != 0) {
+      return std::errc(errno);
+    }
+    return std::errc(0);
+  }
+
+protected:
+  Mapping(std::byte* data, std::size_t size) : mData(data), mSize(size) {}
+
+private:
+  std::byte* mData = nullptr;
+  std::size_t mSize = 0;
+};
 } // namespace np_linux
 
 using namespace stdc;
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "crc32.hpp"
+#include "encoding.hpp"
+#include "errors.hpp"
+#include "file.hpp"
+#include "record.hpp"
+#include "segment.hpp"
+
+#include <array>
+#include <cstring>
+#include <memory>
+
+// a hint file is a sequence of blocks followed by a footer:
+//   block   := payload size(4) + payload + crc32c of the payload(4)
+//   payload := entry*
+//   entry   := shared key size + unshared key size + type(1) + batch id + segment id + block number +
+//              chunk offset + chunk size + unshared key bytes, every number but the type is a varint
+//   footer  := block count(4) + entry count(8) + magic(8)
+// a key is stored as the bytes it does not share with the key before it in the same block, the first
+// key of every block is stored whole.
+constexpr auto kHintMagic = std::array<char, 8>{'N', 'P', 'H', 'I', 'N', 'T', '0', '1'};
+constexpr std::size_t kHintFooterSize = 20;
+constexpr std::size_t kHintBlockSize = 4 * KiB;
+
+struct HintEntry {
+  std::span<std::byte const> key;
+  ChunkPosition position;
+  LogRecordType type = LogRecordType::Normal;
+  std::uint64_t batchID = 0;
+};
+
+// streams entries to a hint file, the file is only readable once `finish` wrote its footer
+class HintWriter {
+public:
+  HintWriter(File file) : mFile(std::move(file)) {}
+  static auto create(std::filesystem::path const& path) -> ext::expected<std::unique_ptr<HintWriter>, std::error_code>
+  {
+    auto file = File::open(path, "wb");
+    if (!file) {
+      return ext::make_unexpected(make_error_code(file.error()));
+    }
+    return std::make_unique<HintWriter>(std::move(file).value());
+  }
+
+  auto add(HintEntry const& entry) -> std::error_code
+  {
+    auto shared = std::size_t(0);
+    auto const maxShared = std::min(entry.key.size(), mLastKey.size());
+    while (shared < maxShared && entry.key[shared] == mLastKey[shared]) {
+      shared++;
+    }
+    auto header = std::array<std::byte, 1 + enc::kMaxVarintSize * 7>();
+    auto n = std::size_t(0);
+    n += enc::putVarint(std::span(header).subspan(n), shared);
+    n += enc::putVarint(std::span(header).subspan(n), entry.key.size() - shared);
+    header[n++] = std::byte(entry.type);
+    n += enc::putVarint(std::span(header).subspan(n), entry.batchID);
+    n += enc::putVarint(std::span(header).subspan(n), entry.position.mSegmentID);
+    n += enc::putVarint(std::span(header).subspan(n), entry.position.mBlockNumber);
+    n += enc::putVarint(std::span(header).subspan(n), std::uint64_t(entry.position.mChunkOffset));
+    n += enc::putVarint(std::span(header).subspan(n), entry.position.mChunkSize);
+    mBlock.insert(mBlock.end(), header.begin(), header.begin() + n);
+    mBlock.insert(mBlock.end(), entry.key.begin() + shared, entry.key.end());
+    mLastKey.assign(entry.key.begin(), entry.key.end());
+    mEntryCount++;
+    if (mBlock.size() >= kHintBlockSize) {
+      return flushBlock();
+    }
+    return DbErr::Ok;
+  }
+  // write the last block and the footer and sync the file
+  auto finish() -> std::error_code
+  {
+    if (auto err = flushBlock(); err) {
+      return err;
+    }
+    auto footer = std::array<std::byte, kHintFooterSize>();
+    enc::put(footer, mBlockCount);
+    enc::put(std::span(footer).subspan(4), mEntryCount);
+    enc::put(std::span(footer).subspan(12), kHintMagic);
+    if (!mFile.write(footer)) {
+      return make_error_code(std::errc::io_error);
+    }
+    if (auto r = mFile.sync(); r != std::errc(0)) {
+      return make_error_code(r);
+    }
+    if (!mFile.close()) {
+      return make_error_code(std::errc::io_error);
+    }
+    return DbErr::Ok;
+  }
+  auto entryCount() const -> std::uint64_t { return mEntryCount; }
+
+private:
+  auto flushBlock() -> std::error_code
+  {
+    if (mBlock.empty()) {
+      return DbErr::Ok;
+    }
+    auto size = std::array<std::byte, 4>();
+    auto crc = std::array<std::byte, 4>();
+    enc::put(size, std::uint32_t(mBlock.size()));
+    enc::put(crc, crc32c(mBlock));
+    if (!mFile.write(size) || !mFile.write(mBlock) || !mFile.write(crc)) {
+      return make_error_code(std::errc::io_error);
+    }
+    mBlock.clear();
+    mLastKey.clear();
+    mBlockCount++;
+    return DbErr::Ok;
+  }
+
+  File mFile;
+  std::vector<std::byte> mBlock;
+  std::vector<std::byte> mLastKey;
+  std::uint32_t mBlockCount = 0;
+  std::uint64_t mEntryCount = 0;
+};
+
+// reads a hint file through a read-only mapping, every block is checked before its entries are handed out.
+// keys stored whole are views of the mapping, only keys that share a prefix are assembled.
+class HintReader {
+public:
+  static auto open(std::filesystem::path const& path) -> ext::expected<HintReader, std::error_code>
+  {
+    auto file = np_linux::File::open(path, "r");
+    if (!file) {
+      return ext::make_unexpected(make_error_code(file.error()));
+    }
+    auto size = std::filesystem::file_size(path);
+    if (size < kHintFooterSize) {
+      return ext::make_unexpected(DbErr::InvalidHintFile);
+    }
+    auto mapping = np_linux::Mapping::map(*file, size);
+    if (!mapping) {
+      return ext::make_unexpected(make_error_code(mapping.error()));
+    }
+    auto reader = HintReader(std::move(mapping).value());
+    auto footer = reader.mMapping->span().last(kHintFooterSize);
+    if (std::memcmp(footer.data() + 12, kHintMagic.data(), kHintMagic.size()) != 0) {
+      return ext::make_unexpected(DbErr::InvalidHintFile);
+    }
+    enc::get(footer.subspan(4), reader.mEntryCount);
+    reader.mMapping->advise(MADV_SEQUENTIAL);
+    return reader;
+  }
+
+  // the next entry, false once all are read. `entry.key` is valid until the next call.
+  auto next(HintEntry& entry) -> ext::expected<bool, std::error_code>
+  {
+    if (mBlock.empty()) {
+      if (mRest.empty()) {
+        return false;
+      }
+      if (auto err = nextBlock(); err) {
+        return ext::make_unexpected(err);
+      }
+    }
+    std::uint64_t shared, unshared, type, batchID, segmentID, blockNumber, chunkOffset, chunkSize;
+    auto ok = getVarint(shared) && getVarint(unshared) && getByte(type) && getVarint(batchID) &&
+              getVarint(segmentID) && getVarint(blockNumber) && getVarint(chunkOffset) && getVarint(chunkSize);
+    if (!ok || shared > mKey.size() || unshared > mBlock.size()) {
+      return ext::make_unexpected(DbErr::InvalidHintFile);
+    }
+    auto suffix = mBlock.first(unshared);
+    mBlock = mBlock.subspan(unshared);
+    if (shared == 0) {
+      mKey = suffix;
+    } else {
+      if (mKey.data() != mKeyBuffer.data()) {
+        mKeyBuffer.assign(mKey.begin(), mKey.begin() + shared);
+      } else {
+        mKeyBuffer.resize(shared);
+      }
+      mKeyBuffer.insert(mKeyBuffer.end(), suffix.begin(), suffix.end());
+      mKey = mKeyBuffer;
+    }
+    entry = HintEntry{
+        .key = mKey,
+        .position = ChunkPosition{SegmentID(segmentID), std::uint32_t(blockNumber), std::int64_t(chunkOffset),
+                                  std::uint32_t(chunkSize)},
+        .type = LogRecordType(type),
+        .batchID = batchID,
+    };
+    return true;
+  }
+  auto entryCount() const -> std::uint64_t { return mEntryCount; }
+
+private:
+  HintReader(np_linux::Mapping mapping)
+      : mMapping(std::make_shared<np_linux::Mapping>(std::move(mapping))),
+        mRest(mMapping->span().first(mMapping->size() - kHintFooterSize))
+  {
+  }
+
+  auto nextBlock() -> std::error_code
+  {
+    auto size = std::uint32_t();
+    if (mRest.size() < 8) {
+      return DbErr::InvalidHintFile;
+    }
+    enc::get(mRest, size);
+    if (mRest.size() < 8 + std::size_t(size)) {
+      return DbErr::InvalidHintFile;
+    }
+    auto payload = mRest.subspan(4, size);
+    auto crc = std::uint32_t();
+    enc::get(mRest.subspan(4 + size), crc);
+    if (crc32c(payload) != crc) {
+      return SegmentErr::InvalidCheckSum;
+    }
+    mBlock = payload;
+    mRest = mRest.subspan(8 + size);
+    mKey = {};
+    return DbErr::Ok;
+  }
+  auto getVarint(std::uint64_t& value) -> bool
+  {
+    auto n = enc::getVarint(mBlock, value);
+    mBlock = mBlock.subspan(n);
+    return n != 0;
+  }
+  auto getByte(std::uint64_t& value) -> bool
+  {
+    if (mBlock.empty()) {
+      return false;
+    }
+    value = std::to_integer<std::uint64_t>(mBlock[0]);
+    mBlock = mBlock.subspan(1);
+    return true;
+  }
+
+  // shared so a reader can be moved without invalidating the views into the mapping
+  std::shared_ptr<np_linux::Mapping> mMapping;
+  std::span<std::byte const> mRest;
+  std::span<std::byte const> mBlock;
+  std::span<std::byte const> mKey;
+  std::vector<std::byte> mKeyBuffer;
+  std::uint64_t mEntryCount = 0;
+};
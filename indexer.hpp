@@ -1,54 +1,568 @@
 #pragma once
+#include "arena.hpp"
+#include "art.hpp"
 #include "preclude.hpp"
 #include "segment.hpp"
-#include <unordered_map>
+#include <bit>
+#include <memory>
+#include <shared_mutex>
+#include <variant>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-class MemoryMap {
+namespace swiss {
+// every slot has a control byte: empty, deleted, or the low 7 bits of its key's hash when full
+using CtrlByte = std::int8_t;
+constexpr CtrlByte kCtrlEmpty = -128;
+constexpr CtrlByte kCtrlDeleted = -2;
+constexpr std::size_t kGroupWidth = 16;
+
+// the control bytes of `kGroupWidth` consecutive slots, compared at once. a match is a mask with bit i
+// set for slot i of the group.
+class Group {
 public:
-  MemoryMap() = default;
-  MemoryMap(MemoryMap const&) = delete;
-  MemoryMap& operator=(MemoryMap const&) = delete;
-  MemoryMap(MemoryMap&&) = default;
-  MemoryMap& operator=(MemoryMap&&) = default;
-  ~MemoryMap() = default;
+  explicit Group(CtrlByte const* ctrl)
+  {
+#ifdef __SSE2__
+    mCtrl = _mm_loadu_si128(reinterpret_cast<__m128i const*>(ctrl));
+#else
+    std::copy(ctrl, ctrl + kGroupWidth, mCtrl.begin());
+#endif
+  }
+  auto match(CtrlByte h2) const -> std::uint32_t
+  {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(mCtrl, _mm_set1_epi8(h2)));
+#else
+    return matchIf([&](CtrlByte c) { return c == h2; });
+#endif
+  }
+  auto matchEmpty() const -> std::uint32_t
+  {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(mCtrl, _mm_set1_epi8(kCtrlEmpty)));
+#else
+    return matchIf([](CtrlByte c) { return c == kCtrlEmpty; });
+#endif
+  }
+  // empty and deleted are the only control bytes with the sign bit set
+  auto matchEmptyOrDeleted() const -> std::uint32_t
+  {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(mCtrl);
+#else
+    return matchIf([](CtrlByte c) { return c < 0; });
+#endif
+  }
+
+private:
+#ifdef __SSE2__
+  __m128i mCtrl;
+#else
+  template <typename Pred>
+  auto matchIf(Pred pred) const -> std::uint32_t
+  {
+    auto mask = std::uint32_t(0);
+    for (auto i = std::size_t(0); i < kGroupWidth; i++) {
+      mask |= std::uint32_t(pred(mCtrl[i])) << i;
+    }
+    return mask;
+  }
+  std::array<CtrlByte, kGroupWidth> mCtrl;
+#endif
+};
+} // namespace swiss
 
-  auto put(Bytes bytes, ChunkPosition position) -> void { mMap.emplace(std::move(bytes), position); }
+// an open addressing hash table with positions stored inline next to their keys. lookups probe a group
+// of control bytes at a time and only compare keys whose 7 hash bits match, so a miss rarely touches a
+// slot. the control array repeats its first group past the end so a group can be loaded at any slot.
+// short keys are inlined in their slot, longer ones live in the map's KeyArena.
+class SwissMap {
+public:
+  SwissMap() = default;
+  SwissMap(SwissMap const&) = delete;
+  SwissMap& operator=(SwissMap const&) = delete;
+  SwissMap(SwissMap&& rhs) noexcept { swap(rhs); }
+  SwissMap& operator=(SwissMap&& rhs) noexcept
+  {
+    auto tmp = SwissMap(std::move(rhs));
+    swap(tmp);
+    return *this;
+  }
+  ~SwissMap() = default;
 
-  auto get(Bytes bytes) -> std::optional<ChunkPosition>
+  auto put(BytesView key, ChunkPosition position) -> void { put(key, position, BytesHash()(key)); }
+  // `hash` is `BytesHash()(key)`, for callers that already computed it
+  auto put(BytesView key, ChunkPosition position, std::size_t hash) -> void
   {
-    if (auto it = mMap.find(bytes); it != mMap.end()) {
-      return it->second;
+    if (auto slot = find(key, hash); slot != nullptr) {
+      slot->position = PackedPosition(position);
+      return;
+    }
+    if (mCapacity == 0) {
+      rehash(swiss::kGroupWidth);
+    }
+    auto i = findInsertSlot(hash);
+    if (mGrowthLeft == 0 && mCtrl[i] == swiss::kCtrlEmpty) {
+      // many deleted slots are reclaimed in place, otherwise the table doubles
+      rehash(mSize * 2 < maxLoad(mCapacity) ? mCapacity : mCapacity * 2);
+      i = findInsertSlot(hash);
+    }
+    if (mCtrl[i] == swiss::kCtrlEmpty) {
+      mGrowthLeft--;
+    }
+    setCtrl(i, h2(hash));
+    mSlots[i] = Slot{mArena.store(key.span()), PackedPosition(position)};
+    mSize++;
+    mKeyBytes += key.size();
+  }
+
+  auto get(BytesView key) const -> std::optional<ChunkPosition> { return get(key, BytesHash()(key)); }
+  auto get(BytesView key, std::size_t hash) const -> std::optional<ChunkPosition>
+  {
+    if (auto slot = find(key, hash); slot != nullptr) {
+      return slot->position.unpack();
     }
     return std::nullopt;
   }
-  auto getPtr(Bytes bytes) -> ChunkPosition*
+  auto getPtr(BytesView key) -> PackedPosition*
   {
-    if (auto it = mMap.find(bytes); it != mMap.end()) {
-      return &it->second;
+    if (auto slot = find(key, BytesHash()(key)); slot != nullptr) {
+      return &slot->position;
     }
     return nullptr;
   }
-  auto del(Bytes bytes) -> bool
+  auto del(BytesView key) -> bool { return remove(key).has_value(); }
+  auto remove(BytesView key) -> std::optional<ChunkPosition> { return remove(key, BytesHash()(key)); }
+  auto remove(BytesView key, std::size_t hash) -> std::optional<ChunkPosition>
   {
-    if (auto it = mMap.find(bytes); it != mMap.end()) {
-      mMap.erase(it);
-      return true;
+    auto slot = find(key, hash);
+    if (slot == nullptr) {
+      return std::nullopt;
     }
-    return false;
+    auto position = slot->position.unpack();
+    mArena.release(slot->key);
+    mKeyBytes -= key.size();
+    *slot = Slot();
+    setCtrl(std::size_t(slot - mSlots.get()), swiss::kCtrlDeleted);
+    mSize--;
+    return position;
   }
-  auto remove(Bytes bytes) -> std::optional<ChunkPosition>
+  auto size() const -> std::size_t { return mSize; }
+  auto reserve(std::size_t count) -> void
   {
-    if (auto it = mMap.find(bytes); it != mMap.end()) {
-      auto position = it->second;
-      mMap.erase(it);
-      return position;
+    if (count <= maxLoad(mCapacity)) {
+      return;
     }
-    return std::nullopt;
+    auto capacity = std::max(swiss::kGroupWidth, std::bit_ceil(count));
+    while (maxLoad(capacity) < count) {
+      capacity *= 2;
+    }
+    rehash(capacity);
+  }
+  // call `fn(key, position)` for every key, in no particular order
+  template <typename Fn>
+  auto forEach(Fn&& fn) const -> void
+  {
+    for (auto i = std::size_t(0); i < mCapacity; i++) {
+      if (mCtrl[i] >= 0) {
+        fn(mSlots[i].key.view(), mSlots[i].position.unpack());
+      }
+    }
+  }
+  // copy the live keys into a new arena if any were removed, which frees the space of the dead ones
+  auto compact() -> void
+  {
+    if (mArena.deadBytes() == 0) {
+      return;
+    }
+    auto arena = KeyArena();
+    for (auto i = std::size_t(0); i < mCapacity; i++) {
+      if (mCtrl[i] >= 0) {
+        mSlots[i].key = arena.store(mSlots[i].key.view());
+      }
+    }
+    mArena = std::move(arena);
+  }
+  auto memoryStat() const -> IndexMemoryStat
+  {
+    auto table = mCapacity == 0 ? 0 : mCapacity * sizeof(Slot) + mCapacity + swiss::kGroupWidth;
+    return IndexMemoryStat{
+        .keyCount = mSize,
+        .keyBytes = mKeyBytes,
+        .indexBytes = table + mArena.allocatedBytes(),
+        .deadKeyBytes = mArena.deadBytes(),
+    };
+  }
+
+private:
+  struct Slot {
+    KeyRef key;
+    PackedPosition position;
+  };
+
+  static auto h1(std::size_t hash) -> std::size_t { return hash >> 7; }
+  static auto h2(std::size_t hash) -> swiss::CtrlByte { return swiss::CtrlByte(hash & 0x7f); }
+  // at most 7/8 of the slots are used, which keeps probe sequences short
+  static auto maxLoad(std::size_t capacity) -> std::size_t { return capacity - capacity / 8; }
+
+  auto find(BytesView key, std::size_t hash) const -> Slot*
+  {
+    if (mCapacity == 0) {
+      return nullptr;
+    }
+    auto const mask = mCapacity - 1;
+    auto pos = h1(hash) & mask;
+    for (auto step = std::size_t(0);; step += swiss::kGroupWidth, pos = (pos + step) & mask) {
+      auto group = swiss::Group(&mCtrl[pos]);
+      for (auto match = group.match(h2(hash)); match != 0; match &= match - 1) {
+        auto i = (pos + std::countr_zero(match)) & mask;
+        if (BytesView(mSlots[i].key.view()) == key) {
+          return &mSlots[i];
+        }
+      }
+      if (group.matchEmpty() != 0) {
+        return nullptr;
+      }
+    }
+  }
+  // the first empty or deleted slot on the probe sequence of `hash`
+  auto findInsertSlot(std::size_t hash) const -> std::size_t
+  {
+    auto const mask = mCapacity - 1;
+    auto pos = h1(hash) & mask;
+    for (auto step = std::size_t(0);; step += swiss::kGroupWidth, pos = (pos + step) & mask) {
+      if (auto match = swiss::Group(&mCtrl[pos]).matchEmptyOrDeleted(); match != 0) {
+        return (pos + std::countr_zero(match)) & mask;
+      }
+    }
+  }
+  auto setCtrl(std::size_t i, swiss::CtrlByte ctrl) -> void
+  {
+    mCtrl[i] = ctrl;
+    // the copy of the first group behind the last slot
+    mCtrl[((i - swiss::kGroupWidth) & (mCapacity - 1)) + swiss::kGroupWidth] = ctrl;
+  }
+  // the slots move to a new table, the keys they refer to stay in the arena
+  auto rehash(std::size_t capacity) -> void
+  {
+    auto old = SwissMap();
+    swapTable(old);
+    mCapacity = capacity;
+    mCtrl = std::make_unique<swiss::CtrlByte[]>(capacity + swiss::kGroupWidth);
+    std::fill_n(mCtrl.get(), capacity + swiss::kGroupWidth, swiss::kCtrlEmpty);
+    mSlots = std::make_unique<Slot[]>(capacity);
+    mGrowthLeft = maxLoad(capacity);
+    for (auto i = std::size_t(0); i < old.mCapacity; i++) {
+      if (old.mCtrl[i] < 0) {
+        continue;
+      }
+      auto hash = BytesHash()(old.mSlots[i].key.view());
+      auto j = findInsertSlot(hash);
+      setCtrl(j, h2(hash));
+      mSlots[j] = old.mSlots[i];
+    }
+    mSize = old.mSize;
+    mGrowthLeft -= mSize;
+  }
+  auto swapTable(SwissMap& rhs) noexcept -> void
+  {
+    std::swap(mCtrl, rhs.mCtrl);
+    std::swap(mSlots, rhs.mSlots);
+    std::swap(mCapacity, rhs.mCapacity);
+    std::swap(mSize, rhs.mSize);
+    std::swap(mGrowthLeft, rhs.mGrowthLeft);
+  }
+  auto swap(SwissMap& rhs) noexcept -> void
+  {
+    swapTable(rhs);
+    std::swap(mArena, rhs.mArena);
+    std::swap(mKeyBytes, rhs.mKeyBytes);
+  }
+
+  std::unique_ptr<swiss::CtrlByte[]> mCtrl;
+  std::unique_ptr<Slot[]> mSlots;
+  std::size_t mCapacity = 0;
+  std::size_t mSize = 0;
+  // empty slots that may still be filled before the table has to be rehashed
+  std::size_t mGrowthLeft = 0;
+  KeyArena mArena;
+  std::size_t mKeyBytes = 0;
+};
+
+constexpr std::size_t kIndexShardBits = 6;
+// keys an ordered index visits under one hold of its lock when it is walked whole
+constexpr std::size_t kIndexVisitBatch = 256;
+
+// the index shared by readers and writers. keys are spread over shards by the top bits of their hash,
+// every shard has its own lock, so a lookup only waits for a writer of the same shard and only for the
+// length of one table operation. there is no `getPtr`, a position must not be used after its shard is
+// unlocked.
+class ShardedIndex {
+public:
+  ShardedIndex()
+  {
+    mShards.reserve(std::size_t(1) << kIndexShardBits);
+    for (auto i = std::size_t(0); i < (std::size_t(1) << kIndexShardBits); i++) {
+      mShards.push_back(std::make_unique<Shard>());
+    }
+  }
+  ShardedIndex(ShardedIndex const&) = delete;
+  ShardedIndex& operator=(ShardedIndex const&) = delete;
+  ShardedIndex(ShardedIndex&&) = default;
+  ShardedIndex& operator=(ShardedIndex&&) = default;
+  ~ShardedIndex() = default;
+
+  auto put(BytesView key, ChunkPosition position) -> void
+  {
+    auto hash = BytesHash()(key);
+    auto& shard = shardOf(hash);
+    auto lk = std::unique_lock(shard.mutex);
+    shard.map.put(key, position, hash);
+  }
+  auto get(BytesView key) const -> std::optional<ChunkPosition>
+  {
+    auto hash = BytesHash()(key);
+    auto& shard = shardOf(hash);
+    auto lk = std::shared_lock(shard.mutex);
+    return shard.map.get(key, hash);
+  }
+  auto contains(BytesView key) const -> bool { return get(key).has_value(); }
+  auto del(BytesView key) -> bool { return remove(key).has_value(); }
+  auto remove(BytesView key) -> std::optional<ChunkPosition>
+  {
+    auto hash = BytesHash()(key);
+    auto& shard = shardOf(hash);
+    auto lk = std::unique_lock(shard.mutex);
+    return shard.map.remove(key, hash);
+  }
+  auto size() const -> std::size_t
+  {
+    auto total = std::size_t(0);
+    for (auto const& shard : mShards) {
+      auto lk = std::shared_lock(shard->mutex);
+      total += shard->map.size();
+    }
+    return total;
+  }
+  auto reserve(std::size_t count) -> void
+  {
+    for (auto& shard : mShards) {
+      auto lk = std::unique_lock(shard->mutex);
+      shard->map.reserve((count + mShards.size() - 1) / mShards.size());
+    }
+  }
+  // call `fn(key, position)` for every key, in no particular order. each shard is locked while it is
+  // visited, a consistent view needs writers stopped by the caller.
+  template <typename Fn>
+  auto forEach(Fn&& fn) const -> void
+  {
+    for (auto const& shard : mShards) {
+      auto lk = std::shared_lock(shard->mutex);
+      shard->map.forEach(fn);
+    }
+  }
+  auto compact() -> void
+  {
+    for (auto& shard : mShards) {
+      auto lk = std::unique_lock(shard->mutex);
+      shard->map.compact();
+    }
+  }
+  auto memoryStat() const -> IndexMemoryStat
+  {
+    auto stat = IndexMemoryStat{.indexBytes = mShards.size() * sizeof(Shard)};
+    for (auto const& shard : mShards) {
+      auto lk = std::shared_lock(shard->mutex);
+      stat += shard->map.memoryStat();
+    }
+    return stat;
   }
-  auto size() const -> std::size_t { return mMap.size(); }
 
 private:
-  std::unordered_map<Bytes, ChunkPosition, BytesHash> mMap;
+  struct Shard {
+    mutable std::shared_mutex mutex;
+    SwissMap map;
+  };
+
+  auto shardOf(std::size_t hash) const -> Shard&
+  {
+    // the table inside a shard probes with the low bits
+    return *mShards[std::uint64_t(hash) >> (64 - kIndexShardBits)];
+  }
+
+  std::vector<std::unique_ptr<Shard>> mShards;
 };
 
-using Indexer = MemoryMap;
\ No newline at end of file
+// an ArtTree behind one reader-writer lock
+class ArtIndex {
+public:
+  ArtIndex() = default;
+  ArtIndex(ArtIndex const&) = delete;
+  ArtIndex& operator=(ArtIndex const&) = delete;
+  ArtIndex(ArtIndex&&) = default;
+  ArtIndex& operator=(ArtIndex&&) = default;
+  ~ArtIndex() = default;
+
+  auto put(BytesView key, ChunkPosition position) -> void
+  {
+    auto lk = std::unique_lock(*mMutex);
+    mTree.put(key.span(), position);
+  }
+  auto get(BytesView key) const -> std::optional<ChunkPosition>
+  {
+    auto lk = std::shared_lock(*mMutex);
+    return mTree.get(key.span());
+  }
+  auto contains(BytesView key) const -> bool { return get(key).has_value(); }
+  auto del(BytesView key) -> bool { return remove(key).has_value(); }
+  auto remove(BytesView key) -> std::optional<ChunkPosition>
+  {
+    auto lk = std::unique_lock(*mMutex);
+    return mTree.remove(key.span());
+  }
+  auto size() const -> std::size_t
+  {
+    auto lk = std::shared_lock(*mMutex);
+    return mTree.size();
+  }
+  auto reserve(std::size_t) -> void {}
+  // call `fn(key, position)` for every key in order. the lock is dropped after every `kIndexVisitBatch`
+  // keys and the walk resumes at the next key, so writers wait for one batch only. a key written
+  // meanwhile is seen with its old or its new position, or not at all.
+  template <typename Fn>
+  auto forEach(Fn&& fn) const -> void
+  {
+    auto resume = std::vector<std::byte>();
+    for (auto more = true; more;) {
+      more = false;
+      auto visited = std::size_t(0);
+      auto lk = std::shared_lock(*mMutex);
+      mTree.ascend(resume, {}, [&](std::span<std::byte const> key, ChunkPosition const& position) {
+        if (visited++ == kIndexVisitBatch) {
+          resume.assign(key.begin(), key.end());
+          more = true;
+          return false;
+        }
+        fn(key, position);
+        return true;
+      });
+    }
+  }
+  // writers wait until `fn` stops the scan
+  template <typename Fn>
+  auto ascend(BytesView low, BytesView high, Fn&& fn) const -> void
+  {
+    auto lk = std::shared_lock(*mMutex);
+    mTree.ascend(low.span(), high.span(), fn);
+  }
+  template <typename Fn>
+  auto descend(BytesView low, BytesView high, Fn&& fn) const -> void
+  {
+    auto lk = std::shared_lock(*mMutex);
+    mTree.descend(low.span(), high.span(), fn);
+  }
+  auto compact() -> void
+  {
+    auto lk = std::unique_lock(*mMutex);
+    mTree.compact();
+  }
+  auto memoryStat() const -> IndexMemoryStat
+  {
+    auto lk = std::shared_lock(*mMutex);
+    return mTree.memoryStat();
+  }
+
+private:
+  std::unique_ptr<std::shared_mutex> mMutex = std::make_unique<std::shared_mutex>();
+  ArtTree mTree;
+};
+
+// the index of the database, of the type picked when it is opened
+class Indexer {
+public:
+  explicit Indexer(IndexType type = IndexType::Hash)
+  {
+    if (type == IndexType::Art) {
+      mIndex.emplace<ArtIndex>();
+    }
+  }
+  Indexer(Indexer const&) = delete;
+  Indexer& operator=(Indexer const&) = delete;
+  Indexer(Indexer&&) = default;
+  Indexer& operator=(Indexer&&) = default;
+  ~Indexer() = default;
+
+  // the key is copied into the index
+  auto put(BytesView key, ChunkPosition position) -> void
+  {
+    std::visit([&](auto& index) { index.put(key, position); }, mIndex);
+  }
+  auto get(BytesView key) const -> std::optional<ChunkPosition>
+  {
+    return std::visit([&](auto const& index) { return index.get(key); }, mIndex);
+  }
+  auto contains(BytesView key) const -> bool
+  {
+    return std::visit([&](auto const& index) { return index.contains(key); }, mIndex);
+  }
+  auto del(BytesView key) -> bool
+  {
+    return std::visit([&](auto& index) { return index.del(key); }, mIndex);
+  }
+  auto remove(BytesView key) -> std::optional<ChunkPosition>
+  {
+    return std::visit([&](auto& index) { return index.remove(key); }, mIndex);
+  }
+  auto size() const -> std::size_t
+  {
+    return std::visit([](auto const& index) { return index.size(); }, mIndex);
+  }
+  auto reserve(std::size_t count) -> void
+  {
+    std::visit([&](auto& index) { index.reserve(count); }, mIndex);
+  }
+  // call `fn(key, position)` for every key, in key order if the index is ordered. `key` is only valid
+  // during the call.
+  template <typename Fn>
+  auto forEach(Fn&& fn) const -> void
+  {
+    std::visit([&](auto const& index) { index.forEach(fn); }, mIndex);
+  }
+  // give back the key storage of removed keys
+  auto compact() -> void
+  {
+    std::visit([](auto& index) { index.compact(); }, mIndex);
+  }
+  auto memoryStat() const -> IndexMemoryStat
+  {
+    return std::visit([](auto const& index) { return index.memoryStat(); }, mIndex);
+  }
+  // whether the index keeps its keys in order and supports `ascend` and `descend`
+  auto ordered() const -> bool { return std::holds_alternative<ArtIndex>(mIndex); }
+  // call `fn(key, position)` for the keys in [low, high) in ascending order until it returns false, an
+  // empty bound is unbounded. false if the index is not ordered.
+  template <typename Fn>
+  auto ascend(BytesView low, BytesView high, Fn&& fn) const -> bool
+  {
+    if (auto art = std::get_if<ArtIndex>(&mIndex); art != nullptr) {
+      art->ascend(low, high, fn);
+      return true;
+    }
+    return false;
+  }
+  // the keys in [low, high) in descending order
+  template <typename Fn>
+  auto descend(BytesView low, BytesView high, Fn&& fn) const -> bool
+  {
+    if (auto art = std::get_if<ArtIndex>(&mIndex); art != nullptr) {
+      art->descend(low, high, fn);
+      return true;
+    }
+    return false;
+  }
+
+private:
+  std::variant<ShardedIndex, ArtIndex> mIndex;
+};
\ No newline at end of file
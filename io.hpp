@@ -0,0 +1,238 @@
+#pragma once
+
+#include "errors.hpp"
+#include "file.hpp"
+#include "io_uring.hpp"
+#include "option.hpp"
+#include "preclude.hpp"
+
+#include <climits>
+#include <memory>
+#include <sys/uio.h>
+
+struct BlockRead {
+  std::int64_t offset;
+  std::span<std::byte> buffer;
+  std::int64_t result = 0; // bytes read, or -errno
+};
+
+// how segments move bytes between memory and their file
+class IoBackend {
+public:
+  virtual ~IoBackend() = default;
+  // read every request, each `result` is filled in once this returns
+  virtual auto readBlocks(np_linux::File const& file, std::span<BlockRead> reads) -> void = 0;
+  // append all buffers in order, optionally followed by an fsync
+  virtual auto append(np_linux::File& file, std::span<iovec const> iovs, bool sync) -> std::error_code = 0;
+};
+
+class StandardIo : public IoBackend {
+public:
+  auto readBlocks(np_linux::File const& file, std::span<BlockRead> reads) -> void override
+  {
+    for (auto& read : reads) {
+      auto r = file.readAt(read.buffer, read.offset);
+      read.result = r ? std::int64_t(*r) : -errno;
+    }
+  }
+  auto append(np_linux::File& file, std::span<iovec const> iovs, bool sync) -> std::error_code override
+  {
+    if (auto err = appendFrom(file, iovs, 0); err) {
+      return err;
+    }
+    if (sync) {
+      if (auto r = file.sync(); r != std::errc(0)) {
+        return make_error_code(r);
+      }
+    }
+    return SegmentErr::Ok;
+  }
+
+  // writev the buffers, skipping the first `skip` bytes which are already in the file
+  static auto appendFrom(np_linux::File& file, std::span<iovec const> iovs, std::size_t skip) -> std::error_code
+  {
+    auto pending = std::vector<iovec>();
+    pending.reserve(iovs.size());
+    for (auto const& iov : iovs) {
+      if (skip >= iov.iov_len) {
+        skip -= iov.iov_len;
+        continue;
+      }
+      pending.push_back(iovec{static_cast<std::byte*>(iov.iov_base) + skip, iov.iov_len - skip});
+      skip = 0;
+    }
+    auto first = std::size_t(0);
+    while (first < pending.size()) {
+      auto count = std::min<std::size_t>(pending.size() - first, IOV_MAX);
+      auto n = ::writev(file.fd(), &pending[first], int(count));
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return std::error_code(errno, std::system_category());
+      }
+      auto written = std::size_t(n);
+      while (first < pending.size() && written >= pending[first].iov_len) {
+        written -= pending[first].iov_len;
+        first++;
+      }
+      if (written > 0) {
+        pending[first].iov_base = static_cast<std::byte*>(pending[first].iov_base) + written;
+        pending[first].iov_len -= written;
+      }
+    }
+    return SegmentErr::Ok;
+  }
+};
+
+constexpr unsigned kIoUringEntries = 64;
+
+// keeps up to `kIoUringEntries` requests in flight per thread, appends are submitted together with
+// their fsync as one linked chain.
+class UringIo : public IoBackend {
+public:
+  // check once that the kernel lets us create a ring, so misconfiguration surfaces at open
+  static auto available() -> bool { return np_linux::IoUring::create(kIoUringEntries).has_value(); }
+
+  auto readBlocks(np_linux::File const& file, std::span<BlockRead> reads) -> void override
+  {
+    auto ring = threadRing();
+    if (ring == nullptr) {
+      return mFallback.readBlocks(file, reads);
+    }
+    auto first = std::size_t(0);
+    while (first < reads.size()) {
+      auto count = std::min<std::size_t>(reads.size() - first, ring->capacity());
+      auto ok = true;
+      for (auto i = first; ok && i < first + count; i++) {
+        ok = ring->prepareRead(file.fd(), reads[i].buffer, reads[i].offset, i);
+      }
+      if (!ok) {
+        ring->discardPrepared();
+      }
+      // the reads the ring did not finish, and the ones after them, are done synchronously
+      if (!ok || waitAll(*ring, count, [&](auto const& c) { reads[c.userData].result = c.result; }) != std::errc(0)) {
+        mFallback.readBlocks(file, reads.subspan(first));
+        break;
+      }
+      first += count;
+    }
+    // short reads are rare (end of file, signals), finish them synchronously
+    for (auto& read : reads) {
+      if (read.result > 0 && std::size_t(read.result) < read.buffer.size()) {
+        auto r = file.readAt(read.buffer.subspan(read.result), read.offset + read.result);
+        read.result = r ? read.result + std::int64_t(*r) : -errno;
+      }
+    }
+  }
+
+  auto append(np_linux::File& file, std::span<iovec const> iovs, bool sync) -> std::error_code override
+  {
+    auto ring = threadRing();
+    auto writes = (iovs.size() + IOV_MAX - 1) / IOV_MAX;
+    if (ring == nullptr || writes + 1 > ring->capacity()) {
+      return mFallback.append(file, iovs, sync);
+    }
+    auto expected = std::vector<std::size_t>(writes);
+    auto ok = true;
+    for (auto i = std::size_t(0); ok && i < writes; i++) {
+      auto count = std::min<std::size_t>(iovs.size() - i * IOV_MAX, IOV_MAX);
+      for (auto j = i * IOV_MAX; j < i * IOV_MAX + count; j++) {
+        expected[i] += iovs[j].iov_len;
+      }
+      ok = ring->prepareWritev(file.fd(), &iovs[i * IOV_MAX], unsigned(count), i, sync || i + 1 < writes);
+    }
+    if (ok && sync) {
+      ok = ring->prepareFsync(file.fd(), writes, false);
+    }
+    if (!ok) {
+      ring->discardPrepared();
+      return mFallback.append(file, iovs, sync);
+    }
+    auto results = std::vector<std::int32_t>(writes + 1);
+    if (auto err = waitAll(*ring, writes + (sync ? 1 : 0), [&](auto const& c) { results[c.userData] = c.result; });
+        err != std::errc(0)) {
+      return make_error_code(err);
+    }
+    // a short write cancels the rest of the chain, finish the remaining bytes synchronously
+    auto written = std::size_t(0);
+    for (auto i = std::size_t(0); i < writes; i++) {
+      if (results[i] < 0 && results[i] != -ECANCELED) {
+        return std::error_code(-results[i], std::system_category());
+      }
+      if (results[i] < 0 || std::size_t(results[i]) != expected[i]) {
+        written += std::max(results[i], 0);
+        if (auto err = StandardIo::appendFrom(file, iovs, written); err) {
+          return err;
+        }
+        return sync ? syncFile(file) : SegmentErr::Ok;
+      }
+      written += results[i];
+    }
+    if (sync && results[writes] < 0) {
+      return std::error_code(-results[writes], std::system_category());
+    }
+    return SegmentErr::Ok;
+  }
+
+private:
+  static auto threadRingSlot() -> ext::expected<np_linux::IoUring, std::errc>&
+  {
+    thread_local auto ring = np_linux::IoUring::create(kIoUringEntries);
+    return ring;
+  }
+  static auto threadRing() -> np_linux::IoUring*
+  {
+    auto& ring = threadRingSlot();
+    return ring ? &ring.value() : nullptr;
+  }
+  // give up the ring of this thread, its later calls use the fallback
+  static auto dropThreadRing() -> void { threadRingSlot() = ext::make_unexpected(std::errc::io_error); }
+  static auto syncFile(np_linux::File& file) -> std::error_code
+  {
+    if (auto r = file.sync(); r != std::errc(0)) {
+      return make_error_code(r);
+    }
+    return SegmentErr::Ok;
+  }
+  // submit the `count` requests just prepared and hand every completion to `onComplete`. once the ring
+  // fails, the requests it has not taken yet are dropped and the ones in flight are still waited for,
+  // so none of them writes to a buffer or leaves its completion to the next call after this returns.
+  // a ring that can not even be waited on is dropped, `ring` must not be used after an error.
+  static auto waitAll(np_linux::IoUring& ring, std::size_t count, auto&& onComplete) -> std::errc
+  {
+    auto done = std::size_t(0);
+    auto submitted = false;
+    auto failed = std::errc(0);
+    while (done < count) {
+      if (auto completion = ring.popCompletion(); completion) {
+        onComplete(*completion);
+        done++;
+        continue;
+      }
+      auto err = ring.submit(submitted ? 1 : unsigned(count - done));
+      submitted = true;
+      if (err == std::errc(0)) {
+        continue;
+      }
+      if (failed == std::errc(0)) {
+        failed = err;
+        count -= ring.discardPrepared();
+      } else if (err != std::errc::resource_unavailable_try_again && err != std::errc::device_or_resource_busy) {
+        dropThreadRing();
+        return failed;
+      }
+    }
+    return failed;
+  }
+
+  StandardIo mFallback;
+};
+
+inline auto makeIoBackend(IoType type) -> std::shared_ptr<IoBackend>
+{
+  if (type == IoType::IoUring) {
+    return std::make_shared<UringIo>();
+  }
+  return std::make_shared<StandardIo>();
+}
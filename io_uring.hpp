@@ -0,0 +1,241 @@
+#pragma once
+
+#include "preclude.hpp"
+
+#include <atomic>
+#include <linux/io_uring.h>
+#include <optional>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace np_linux {
+// minimal io_uring ring driven through the raw syscalls, one instance must only be used by one thread.
+class IoUring {
+public:
+  struct Completion {
+    std::uint64_t userData;
+    std::int32_t result;
+  };
+
+  IoUring() = default;
+  IoUring(IoUring const&) = delete;
+  IoUring& operator=(IoUring const&) = delete;
+  IoUring(IoUring&& other) { swap(other); }
+  IoUring& operator=(IoUring&& other)
+  {
+    swap(other);
+    return *this;
+  }
+  ~IoUring()
+  {
+    if (mSqes != nullptr) {
+      ::munmap(mSqes, mSqesSize);
+    }
+    if (mCqRing != nullptr && mCqRing != mSqRing) {
+      ::munmap(mCqRing, mCqRingSize);
+    }
+    if (mSqRing != nullptr) {
+      ::munmap(mSqRing, mSqRingSize);
+    }
+    if (mFd != -1) {
+      ::close(mFd);
+    }
+  }
+
+  inline static auto create(unsigned entries) -> ext::expected<IoUring, std::errc>
+  {
+    auto params = io_uring_params{};
+    auto ring = IoUring();
+    ring.mFd = int(::syscall(__NR_io_uring_setup, entries, &params));
+    if (ring.mFd < 0) {
+      return ext::make_unexpected(std::errc(errno));
+    }
+    ring.mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    auto singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+      ring.mSqRingSize = ring.mCqRingSize = std::max(ring.mSqRingSize, ring.mCqRingSize);
+    }
+    auto sq = ::mmap(nullptr, ring.mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.mFd,
+                     IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+      return ext::make_unexpected(std::errc(errno));
+    }
+    ring.mSqRing = static_cast<std::byte*>(sq);
+    if (singleMmap) {
+      ring.mCqRing = ring.mSqRing;
+    } else {
+      auto cq = ::mmap(nullptr, ring.mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.mFd,
+                       IORING_OFF_CQ_RING);
+      if (cq == MAP_FAILED) {
+        return ext::make_unexpected(std::errc(errno));
+      }
+      ring.mCqRing = static_cast<std::byte*>(cq);
+    }
+    ring.mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    auto sqes = ::mmap(nullptr, ring.mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.mFd,
+                       IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      return ext::make_unexpected(std::errc(errno));
+    }
+    ring.mSqes = static_cast<io_uring_sqe*>(sqes);
+
+    ring.mSqHead = reinterpret_cast<unsigned*>(ring.mSqRing + params.sq_off.head);
+    ring.mSqTail = reinterpret_cast<unsigned*>(ring.mSqRing + params.sq_off.tail);
+    ring.mSqMask = *reinterpret_cast<unsigned*>(ring.mSqRing + params.sq_off.ring_mask);
+    ring.mSqArray = reinterpret_cast<unsigned*>(ring.mSqRing + params.sq_off.array);
+    ring.mCqHead = reinterpret_cast<unsigned*>(ring.mCqRing + params.cq_off.head);
+    ring.mCqTail = reinterpret_cast<unsigned*>(ring.mCqRing + params.cq_off.tail);
+    ring.mCqMask = *reinterpret_cast<unsigned*>(ring.mCqRing + params.cq_off.ring_mask);
+    ring.mCqes = reinterpret_cast<io_uring_cqe*>(ring.mCqRing + params.cq_off.cqes);
+    ring.mEntries = params.sq_entries;
+    return ring;
+  }
+
+  auto capacity() const -> unsigned { return mEntries; }
+  auto isValid() const -> bool { return mFd != -1; }
+
+  auto prepareRead(int fd, std::span<std::byte> buffer, std::int64_t offset, std::uint64_t userData) -> bool
+  {
+    auto sqe = nextSqe();
+    if (sqe == nullptr) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(buffer.data());
+    sqe->len = std::uint32_t(buffer.size());
+    sqe->off = std::uint64_t(offset);
+    sqe->user_data = userData;
+    return true;
+  }
+  // offset -1 writes at the current file position, which is the end of file for O_APPEND files
+  auto prepareWritev(int fd, iovec const* iovs, unsigned count, std::uint64_t userData, bool link) -> bool
+  {
+    auto sqe = nextSqe();
+    if (sqe == nullptr) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(iovs);
+    sqe->len = count;
+    sqe->off = std::uint64_t(-1);
+    sqe->user_data = userData;
+    if (link) {
+      sqe->flags |= IOSQE_IO_LINK;
+    }
+    return true;
+  }
+  auto prepareFsync(int fd, std::uint64_t userData, bool link) -> bool
+  {
+    auto sqe = nextSqe();
+    if (sqe == nullptr) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->user_data = userData;
+    if (link) {
+      sqe->flags |= IOSQE_IO_LINK;
+    }
+    return true;
+  }
+
+  // submit everything prepared so far and block until at least `waitNr` completions are available
+  auto submit(unsigned waitNr) -> std::errc
+  {
+    for (;;) {
+      auto flags = waitNr > 0 ? IORING_ENTER_GETEVENTS : 0u;
+      auto r = ::syscall(__NR_io_uring_enter, mFd, mToSubmit, waitNr, flags, nullptr, 0);
+      if (r < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return std::errc(errno);
+      }
+      mToSubmit -= unsigned(r);
+      return std::errc(0);
+    }
+  }
+
+  // drop the requests prepared but not submitted yet, the kernel has not seen them. returns how many.
+  auto discardPrepared() -> unsigned
+  {
+    auto count = mToSubmit;
+    std::atomic_ref(*mSqTail).store(*mSqTail - count, std::memory_order_release);
+    mToSubmit = 0;
+    return count;
+  }
+
+  auto popCompletion() -> std::optional<Completion>
+  {
+    auto head = *mCqHead;
+    if (head == std::atomic_ref(*mCqTail).load(std::memory_order_acquire)) {
+      return std::nullopt;
+    }
+    auto const& cqe = mCqes[head & mCqMask];
+    auto completion = Completion{cqe.user_data, cqe.res};
+    std::atomic_ref(*mCqHead).store(head + 1, std::memory_order_release);
+    return completion;
+  }
+
+private:
+  auto nextSqe() -> io_uring_sqe*
+  {
+    auto tail = *mSqTail;
+    auto head = std::atomic_ref(*mSqHead).load(std::memory_order_acquire);
+    if (tail - head >= mEntries) {
+      return nullptr;
+    }
+    auto index = tail & mSqMask;
+    auto sqe = &mSqes[index];
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+    mSqArray[index] = index;
+    std::atomic_ref(*mSqTail).store(tail + 1, std::memory_order_release);
+    mToSubmit++;
+    return sqe;
+  }
+
+  auto swap(IoUring& other) -> void
+  {
+    std::swap(mFd, other.mFd);
+    std::swap(mEntries, other.mEntries);
+    std::swap(mToSubmit, other.mToSubmit);
+    std::swap(mSqRing, other.mSqRing);
+    std::swap(mCqRing, other.mCqRing);
+    std::swap(mSqRingSize, other.mSqRingSize);
+    std::swap(mCqRingSize, other.mCqRingSize);
+    std::swap(mSqes, other.mSqes);
+    std::swap(mSqesSize, other.mSqesSize);
+    std::swap(mSqHead, other.mSqHead);
+    std::swap(mSqTail, other.mSqTail);
+    std::swap(mSqMask, other.mSqMask);
+    std::swap(mSqArray, other.mSqArray);
+    std::swap(mCqHead, other.mCqHead);
+    std::swap(mCqTail, other.mCqTail);
+    std::swap(mCqMask, other.mCqMask);
+    std::swap(mCqes, other.mCqes);
+  }
+
+  int mFd = -1;
+  unsigned mEntries = 0;
+  unsigned mToSubmit = 0;
+  std::byte* mSqRing = nullptr;
+  std::byte* mCqRing = nullptr;
+  std::size_t mSqRingSize = 0;
+  std::size_t mCqRingSize = 0;
+  io_uring_sqe* mSqes = nullptr;
+  std::size_t mSqesSize = 0;
+  unsigned* mSqHead = nullptr;
+  unsigned* mSqTail = nullptr;
+  unsigned mSqMask = 0;
+  unsigned* mSqArray = nullptr;
+  unsigned* mCqHead = nullptr;
+  unsigned* mCqTail = nullptr;
+  unsigned mCqMask = 0;
+  io_uring_cqe* mCqes = nullptr;
+};
+} // namespace np_linux
@@ -0,0 +1,61 @@
+#include "iterator.hpp"
+#include "record.hpp"
+#include <algorithm>
+#include <numeric>
+
+Iterator::Iterator(KeyArena keys, std::vector<Entry> entries, std::map<SegmentID, std::shared_ptr<Segment>> segments,
+                   IteratorOption option)
+    : mKeys(std::move(keys)), mEntries(std::move(entries)), mSegments(std::move(segments)), mOption(option)
+{
+}
+auto Iterator::value() -> ext::expected<Bytes, std::error_code>
+{
+  if (!valid()) {
+    return ext::make_unexpected(DbErr::KeyNotFound);
+  }
+  if (mOption.keyOnly) {
+    return ext::make_unexpected(DbErr::KeyOnlyIterator);
+  }
+  if (mCurrent < mWindowBegin || mCurrent >= mWindowBegin + mWindow.size()) {
+    prefetch();
+  }
+  return mWindow[mCurrent - mWindowBegin];
+}
+// read the values of the next `prefetch` entries, grouped by segment and in file order within each
+auto Iterator::prefetch() -> void
+{
+  auto count = std::min(std::max<std::size_t>(mOption.prefetch, 1), mEntries.size() - mCurrent);
+  mWindowBegin = mCurrent;
+  mWindow.assign(count, ext::make_unexpected(make_error_code(SegmentErr::SegmentClosed)));
+
+  auto order = std::vector<std::size_t>(count);
+  std::iota(order.begin(), order.end(), mWindowBegin);
+  std::sort(order.begin(), order.end(), [&](auto a, auto b) {
+    auto const l = mEntries[a].position.unpack();
+    auto const r = mEntries[b].position.unpack();
+    return std::tie(l.mSegmentID, l.mBlockNumber, l.mChunkOffset) <
+           std::tie(r.mSegmentID, r.mBlockNumber, r.mChunkOffset);
+  });
+  auto option = ReadOption{.fillCache = mOption.fillCache};
+  auto positions = std::vector<ChunkPosition>();
+  for (auto begin = std::size_t(0); begin < order.size();) {
+    auto id = mEntries[order[begin]].position.unpack().mSegmentID;
+    auto end = begin;
+    positions.clear();
+    while (end < order.size() && mEntries[order[end]].position.unpack().mSegmentID == id) {
+      positions.push_back(mEntries[order[end]].position.unpack());
+      end++;
+    }
+    auto segment = mSegments.find(id);
+    if (segment != mSegments.end()) {
+      auto chunks = segment->second->readMany(positions, option);
+      for (auto i = begin; i < end; i++) {
+        auto& chunk = chunks[i - begin];
+        mWindow[order[i] - mWindowBegin] =
+            chunk ? ext::expected<Bytes, std::error_code>(LogRecord(chunk->span()).value())
+                  : ext::make_unexpected(chunk.error());
+      }
+    }
+    begin = end;
+  }
+}
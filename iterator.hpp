@@ -0,0 +1,52 @@
+#pragma once
+
+#include "arena.hpp"
+#include "segment.hpp"
+#include <map>
+#include <memory>
+#include <vector>
+
+struct IteratorOption {
+  // hand out keys only, no segment is pinned and no value read
+  bool keyOnly = false;
+  // values read ahead of the iterator at once, sorted by their position so every segment is read in order
+  std::size_t prefetch = 64;
+  // put the blocks read into the block cache, off so a full iteration does not evict the hot blocks
+  bool fillCache = false;
+};
+
+// iterates a snapshot of the keys, in key order with an ordered index. the snapshot holds every
+// committed batch entirely or not at all, commits keep appending while it is taken and only their
+// index updates wait. the segments holding their values are pinned, a merge or close meanwhile
+// leaves them readable until the iterator is destroyed.
+class Iterator {
+public:
+  // the keys are copied into the arena of the iterator, not one allocation each
+  struct Entry {
+    KeyRef key;
+    PackedPosition position;
+  };
+
+  Iterator(KeyArena keys, std::vector<Entry> entries, std::map<SegmentID, std::shared_ptr<Segment>> segments,
+           IteratorOption option);
+
+  auto valid() const -> bool { return mCurrent < mEntries.size(); }
+  auto next() -> void { mCurrent++; }
+  // valid until the iterator is destroyed
+  auto key() const -> BytesView { return mEntries[mCurrent].key.view(); }
+  auto value() -> ext::expected<Bytes, std::error_code>;
+  // the number of keys in the snapshot
+  auto size() const -> std::size_t { return mEntries.size(); }
+
+private:
+  auto prefetch() -> void;
+
+  KeyArena mKeys;
+  std::vector<Entry> mEntries;
+  std::map<SegmentID, std::shared_ptr<Segment>> mSegments;
+  IteratorOption mOption;
+  std::size_t mCurrent = 0;
+  // the values of the entries from `mWindowBegin` on, read by the last prefetch
+  std::size_t mWindowBegin = 0;
+  std::vector<ext::expected<Bytes, std::error_code>> mWindow;
+};
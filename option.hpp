@@ -1,11 +1,14 @@
 #pragma once
 
+#include <chrono>
 #include <filesystem>
 
 constexpr std::size_t B = 1;
 constexpr std::size_t KiB = 1024 * B;
 constexpr std::size_t MiB = 1024 * KiB;
 constexpr std::size_t GiB = 1024 * MiB;
+// the index packs block numbers into 24 bits, which covers segments of up to 512 GiB
+constexpr std::size_t kMaxSegmentSize = 512 * GiB;
 
 inline auto tempDBDir() -> std::filesystem::path
 {
@@ -13,21 +16,74 @@ inline auto tempDBDir() -> std::filesystem::path
   std::filesystem::create_directory(path);
   return path;
 }
+enum class IoType {
+  Standard, // pread / writev
+  IoUring,
+};
+enum class ChecksumMode {
+  Always, // verify the checksum of every chunk on every read
+  OnLoad, // verify the chunks of a block once when it is loaded into the block cache
+};
+enum class CachePolicy {
+  Lru,
+  TinyLfu, // frequency based admission, keeps the hot blocks through merge and recovery scans
+};
+enum class IndexType {
+  Hash, // sharded hash tables, point lookups only
+  Art,  // adaptive radix tree, keys in order for range and prefix scans
+};
+
 struct WalOption {
   std::filesystem::path dirPath = std::filesystem::temp_directory_path();
   std::int64_t segmentSize = 1 * GiB;
   std::string segmentFileExt = ".SEG";
+  // bytes of blocks to cache, including the partially written tail block of the active segment
   std::uint32_t blockCache = 32 * KiB * 10;
+  CachePolicy cachePolicy = CachePolicy::Lru;
+  ChecksumMode checksumMode = ChecksumMode::Always;
   bool syncWrite = false;
   std::uint32_t bytesPerSync = 0;
+  // serve reads of sealed segments from a read-only mmap instead of the block cache
+  bool mmapSealedSegments = false;
+  IoType ioType = IoType::Standard;
+  // bytes of appended chunks the active segment keeps in memory before writing them out, 0 writes
+  // on every commit. `syncWrite` and `bytesPerSync` flush the buffer before they fsync.
+  std::uint32_t writeBufferSize = 0;
+  // also flush the write buffer this often, 0 only flushes when it is full
+  std::chrono::milliseconds flushInterval = std::chrono::milliseconds(0);
+};
+
+// how a read treats the shared block cache
+struct ReadOption {
+  // insert blocks read from the file into the cache and promote the cached ones, sequential
+  // background readers turn it off and only use blocks that are already cached
+  bool fillCache = true;
+  // bytes a segment reader fetches ahead of the chunk it returns with one read, 0 reads block by block
+  std::uint32_t readahead = 0;
 };
 
 struct DbOption {
   std::filesystem::path dirPath = tempDBDir();
   std::int64_t segmentSize = 1 * GiB;
   std::uint32_t blockCache = 32 * KiB * 10;
+  CachePolicy cachePolicy = CachePolicy::Lru;
+  ChecksumMode checksumMode = ChecksumMode::Always;
   bool syncWrite = false;
   std::uint32_t bytesPerSync = 0;
+  bool mmapSealedSegments = false;
+  IoType ioType = IoType::Standard;
+  std::uint32_t writeBufferSize = 0;
+  std::chrono::milliseconds flushInterval = std::chrono::milliseconds(0);
+  // readahead of the sequential scans done by merge and recovery
+  std::uint32_t scanReadahead = 4 * MiB;
+  // number of threads scanning segments when the index is rebuilt, 0 means one per core
+  std::uint32_t recoveryThreads = 0;
+  // write a hint file for every sealed segment in the background, recovery reads it instead of the segment
+  bool segmentHints = true;
+  // save the index at close, and every `checkpointInterval` if it is not 0, so open only replays the log after it
+  bool indexCheckpoint = true;
+  std::chrono::milliseconds checkpointInterval = std::chrono::milliseconds(0);
+  IndexType indexType = IndexType::Hash;
   // watch queue
 };
 
@@ -39,4 +95,7 @@ inline auto checkDbOption(DbOption const& option) -> void
   if (option.segmentSize < 0) {
     throw std::invalid_argument("segmentSize is negative");
   }
+  if (std::size_t(option.segmentSize) > kMaxSegmentSize) {
+    throw std::invalid_argument("segmentSize is larger than 512 GiB");
+  }
 }
@@ -4,11 +4,43 @@
 #include "preclude.hpp"
 #include "segment.hpp"
 
+// type(1) + batch id(8) + key size(4) + value size(4)
+constexpr std::size_t kLogRecordHeaderSize = 17;
+
 enum LogRecordType : std::uint8_t {
   Normal,
   Delted,
   Finished,
 };
+
+// the fixed size part of an encoded record
+struct LogRecordHeader {
+  LogRecordType type;
+  std::uint64_t batchID;
+  std::uint32_t keySize;
+  std::uint32_t valueSize;
+
+  static auto decode(std::span<std::byte const> span) -> LogRecordHeader
+  {
+    auto header = LogRecordHeader{.type = LogRecordType(std::to_integer<std::uint8_t>(span[0]))};
+    enc::get(span.subspan(1), header.batchID);
+    enc::get(span.subspan(9), header.keySize);
+    enc::get(span.subspan(13), header.valueSize);
+    return header;
+  }
+  // for `SegmentReader::nextHead`, a record's head is its header and key
+  static auto measure(std::span<std::byte const> span) -> std::optional<ChunkHead>
+  {
+    if (span.size() < kLogRecordHeaderSize) {
+      return std::nullopt;
+    }
+    auto header = decode(span);
+    return ChunkHead{
+        .head = kLogRecordHeaderSize + header.keySize,
+        .size = kLogRecordHeaderSize + header.keySize + header.valueSize,
+    };
+  }
+};
 class LogRecord {
 public:
   LogRecord() = delete;
@@ -36,16 +68,27 @@ public:
 
   auto asBytes() const -> Bytes
   {
-    auto ret = Bytes(1 + 8 + 8 + 4 + 4 + mKey.capacity() + mValue.capacity());
-    auto span = ret.span();
-    span[0] = std::byte(mType);
-    enc::put(span.subspan(1), mBatchID);
-    enc::put(span.subspan(9), std::uint32_t(mKey.capacity()));
-    enc::put(span.subspan(13), std::uint32_t(mValue.capacity()));
-    enc::put(span.subspan(17), mKey.span());
-    enc::put(span.subspan(17 + mKey.capacity()), mValue.span());
+    auto ret = Bytes(encodedSize());
+    encodeTo(ret.span());
     return ret;
   }
+  auto encodedSize() const -> std::size_t { return kLogRecordHeaderSize + mKey.capacity() + mValue.capacity(); }
+  // encode into `buf`, which must hold at least `encodedSize()` bytes
+  auto encodeTo(std::span<std::byte> buf) const -> std::size_t
+  {
+    return encode(buf, mType, mBatchID, mKey.span(), mValue.span());
+  }
+  static auto encode(std::span<std::byte> buf, LogRecordType type, std::uint64_t batchID,
+                     std::span<std::byte const> key, std::span<std::byte const> value) -> std::size_t
+  {
+    buf[0] = std::byte(type);
+    enc::put(buf.subspan(1), batchID);
+    enc::put(buf.subspan(9), std::uint32_t(key.size()));
+    enc::put(buf.subspan(13), std::uint32_t(value.size()));
+    enc::put(buf.subspan(17), key);
+    enc::put(buf.subspan(17 + key.size()), value);
+    return kLogRecordHeaderSize + key.size() + value.size();
+  }
   auto key() const -> Bytes const& { return mKey; }
   auto value() const -> Bytes const& { return mValue; }
   auto type() const -> LogRecordType { return mType; }
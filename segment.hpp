@@ -4,11 +4,19 @@
 #include "encoding.hpp"
 #include "errors.hpp"
 #include "file.hpp"
+#include "io.hpp"
 #include "option.hpp"
 #include "preclude.hpp"
 
+#include <array>
+#include <cassert>
 #include <fcntl.h>
+#include <functional>
+#include <optional>
+#include <shared_mutex>
+#include <type_traits>
 #include <unistd.h>
+#include <unordered_map>
 
 using SegmentID = std::uint32_t;
 
@@ -26,23 +34,111 @@ struct ChunkPosition {
   }
 };
 
+constexpr std::size_t kPackedSegmentBits = 24;
+constexpr std::size_t kPackedBlockBits = 24;
+constexpr std::size_t kPackedOffsetBits = 15;
+constexpr SegmentID kMaxSegmentID = (SegmentID(1) << kPackedSegmentBits) - 1;
+
+// a chunk position as the index stores it, in 12 bytes instead of 24: segment id(24 bits) + block
+// number(24 bits) + chunk offset(15 bits) in two words, and the chunk size. a chunk starts inside
+// its block so the offset is below `kBlockSize`, block numbers are bounded by `kMaxSegmentSize` and
+// segment ids by `kMaxSegmentID`.
+struct PackedPosition {
+  PackedPosition() = default;
+  explicit PackedPosition(ChunkPosition const& pos)
+  {
+    if (!fits(pos)) {
+      throw std::runtime_error("chunk position does not fit the index");
+    }
+    auto bits = std::uint64_t(pos.mSegmentID) | std::uint64_t(pos.mBlockNumber) << kPackedSegmentBits |
+                std::uint64_t(pos.mChunkOffset) << (kPackedSegmentBits + kPackedBlockBits);
+    mLow = std::uint32_t(bits);
+    mHigh = std::uint32_t(bits >> 32);
+    mChunkSize = pos.mChunkSize;
+  }
+  static auto fits(ChunkPosition const& pos) -> bool
+  {
+    return pos.mSegmentID <= kMaxSegmentID && pos.mBlockNumber >> kPackedBlockBits == 0 && pos.mChunkOffset >= 0 &&
+           pos.mChunkOffset >> kPackedOffsetBits == 0;
+  }
+  auto unpack() const -> ChunkPosition
+  {
+    auto bits = std::uint64_t(mHigh) << 32 | mLow;
+    return ChunkPosition{
+        SegmentID(bits & kMaxSegmentID),
+        std::uint32_t(bits >> kPackedSegmentBits & ((std::uint64_t(1) << kPackedBlockBits) - 1)),
+        std::int64_t(bits >> (kPackedSegmentBits + kPackedBlockBits)),
+        mChunkSize,
+    };
+  }
+
+  std::uint32_t mLow = 0;
+  std::uint32_t mHigh = 0;
+  std::uint32_t mChunkSize = 0;
+};
+static_assert(sizeof(PackedPosition) == 12);
+
 struct ChunkHeader {
   std::uint32_t mCrc;
   std::uint16_t mLength;
   ChunkType mType;
 };
 
+// set in the type byte of chunks checksummed with crc32c, chunks written before it use crc32
+constexpr std::uint8_t kChunkCrc32cFlag = 0x80;
+
+inline auto chunkType(ChunkHeader const& header) -> ChunkType
+{
+  return ChunkType(std::uint8_t(header.mType) & ~kChunkCrc32cFlag);
+}
+
 inline auto getChecksum(ChunkHeader const& header, std::span<std::byte const> data) -> std::uint32_t
 {
   auto headerPtr = (std::byte const*)(&header) + 4;
+  if ((std::uint8_t(header.mType) & kChunkCrc32cFlag) != 0) {
+    return crc32c(data, crc32c(headerPtr, 3));
+  }
   auto headerCrc = crc32(headerPtr, 3);
   return crc32(data, headerCrc);
 }
 
 constexpr std::size_t kChunkHeaderSize = 7;
 constexpr std::size_t kBlockSize = 32 * KiB;
+static_assert(kBlockSize == std::size_t(1) << kPackedOffsetBits);
+static_assert(kMaxSegmentSize / kBlockSize <= std::size_t(1) << kPackedBlockBits);
 constexpr int kSegmentFilePerm = 0644;
 
+// the size of a segment of `size` bytes once a record of `dataSize` bytes is appended to it, laid out
+// like `Segment::writeAll` does: a block tail too short for a header is padded and every chunk the
+// record is split into has its own header.
+inline auto sizeAfterAppend(std::int64_t size, std::size_t dataSize) -> std::int64_t
+{
+  constexpr auto kBlock = std::int64_t(kBlockSize);
+  constexpr auto kHeader = std::int64_t(kChunkHeaderSize);
+  constexpr auto kPayload = kBlock - kHeader;
+  auto offset = size % kBlock;
+  if (offset + kHeader >= kBlock) {
+    size += kBlock - offset;
+    offset = 0;
+  }
+  auto left = std::int64_t(dataSize);
+  if (offset + kHeader + left <= kBlock) {
+    return size + kHeader + left;
+  }
+  // the first chunk fills its block, the others start at a block each
+  left -= kPayload - offset;
+  auto blocks = (left + kPayload - 1) / kPayload;
+  return size + (kBlock - offset) + (blocks - 1) * kBlock + kHeader + left - (blocks - 1) * kPayload;
+}
+
+// the part of a chunk a header-only read needs: its first `head` bytes out of `size` in total
+struct ChunkHead {
+  std::size_t head;
+  std::size_t size;
+};
+// given the leading bytes of a chunk read so far, tell how much of it is needed, or nullopt to read more
+using ChunkHeadFn = std::function<std::optional<ChunkHead>(std::span<std::byte const>)>;
+
 class Bytes {
 public:
   Bytes() = default;
@@ -61,6 +157,11 @@ public:
   auto span() -> std::span<std::byte> { return {data(), capacity()}; }
   [[nodiscard]] auto span() const -> std::span<std::byte const> { return {data(), capacity()}; }
   [[nodiscard]] auto clone() const -> Bytes { return *this; }
+  // a view of [offset, offset + size) that shares ownership of the underlying storage
+  [[nodiscard]] auto slice(std::size_t offset, std::size_t size) const -> Bytes
+  {
+    return Bytes(size, std::shared_ptr<std::byte[]>(mData, mData.get() + offset));
+  }
   auto resize(std::size_t cap) -> void
   {
     if (cap > capacity()) {
@@ -91,12 +192,45 @@ private:
   std::size_t mCap = 0;
 };
 
+// a view of bytes owned elsewhere, for keys that are only looked up. it is trivially copyable and
+// never allocates, it must not outlive what it views.
+class BytesView {
+public:
+  BytesView() = default;
+  BytesView(std::byte const* data, std::size_t size) : mData(data), mSize(size) {}
+  BytesView(std::span<std::byte const> bytes) : mData(bytes.data()), mSize(bytes.size()) {}
+  BytesView(Bytes const& bytes) : mData(bytes.data()), mSize(bytes.capacity()) {}
+  BytesView(std::string_view str) : mData((std::byte const*)str.data()), mSize(str.size()) {}
+
+  [[nodiscard]] auto data() const -> std::byte const* { return mData; }
+  [[nodiscard]] auto size() const -> std::size_t { return mSize; }
+  [[nodiscard]] auto empty() const -> bool { return mSize == 0; }
+  [[nodiscard]] auto span() const -> std::span<std::byte const> { return {mData, mSize}; }
+
+  auto operator==(BytesView const& rhs) const -> bool
+  {
+    return mSize == rhs.mSize && (mSize == 0 || std::memcmp(mData, rhs.mData, mSize) == 0);
+  }
+
+private:
+  std::byte const* mData = nullptr;
+  std::size_t mSize = 0;
+};
+static_assert(std::is_trivially_copyable_v<BytesView>);
+
+// hash and equality of Bytes that also take a BytesView, so maps keyed by Bytes are searched without
+// building one
 struct BytesHash {
-  auto operator()(Bytes const& bytes) const -> std::size_t
+  using is_transparent = void;
+  auto operator()(BytesView bytes) const -> std::size_t
   {
-    return std::hash<std::string_view>()(std::string_view((char*)bytes.data(), bytes.capacity()));
+    return std::hash<std::string_view>()(std::string_view((char const*)bytes.data(), bytes.size()));
   }
 };
+struct BytesEqual {
+  using is_transparent = void;
+  auto operator()(BytesView lhs, BytesView rhs) const -> bool { return lhs == rhs; }
+};
 
 class Buffer : public Bytes {
 public:
@@ -139,21 +273,31 @@ inline auto segmentFileName(std::string_view dirPath, std::string_view extName,
   return path(dirPath) / std::format("{:09}{}", id, extName);
 }
 
+// blocks are charged by their size, so the cache budget is in bytes and partial blocks count less
+struct BlockWeigher {
+  static constexpr std::size_t kTypicalWeight = kBlockSize;
+  static auto weigh(Bytes const& block) -> std::size_t { return block.capacity(); }
+};
+using BlockCache = ShardedCache<std::uint64_t, Bytes, BlockWeigher>;
+
 class SegmentReader;
 
 class Segment {
 public:
   Segment(std::string_view dirPath, std::string_view extName, SegmentID id,
-          std::shared_ptr<Cache<std::uint64_t, Bytes>> cache)
-      : mId(id), mCache(std::move(cache))
+          std::shared_ptr<BlockCache> cache, std::shared_ptr<IoBackend> io = nullptr)
+      : mId(id), mCache(std::move(cache)), mIo(std::move(io))
   {
+    if (mIo == nullptr) {
+      mIo = makeIoBackend(IoType::Standard);
+    }
     mFilePath = segmentFileName(dirPath, extName, id);
 
-    auto file = File::open(mFilePath, "a+b");
+    auto file = np_linux::File::open(mFilePath, "a+b");
     if (!file) {
       throw std::system_error(make_error_code(file.error()));
     }
-    std::errc r = file->seek(0, File::End);
+    std::errc r = file->seek(0, SEEK_END);
     if (r != std::errc(0)) {
       throw std::system_error(make_error_code(r));
     }
@@ -165,19 +309,42 @@ public:
     log_debug("segment file %s size: %ld\n", mFilePath.c_str(), *offset);
     mCurrentBlockNumber = *offset / kBlockSize;
     mCurrentBlockSize = *offset % kBlockSize;
+    mFlushedSize = *offset;
   }
   ~Segment()
   {
     if (!isClosed()) {
-      mFile.close();
+      close();
     }
   }
 
+  // keep up to `size` bytes of appended chunks in memory before they are written to the file,
+  // 0 writes every append through.
+  auto setWriteBuffer(std::size_t size) -> void
+  {
+    auto lk = std::unique_lock(mRwMutex);
+    mWriteBufferSize = size;
+    mWriteBuffer.reserve(size);
+  }
+  auto setChecksumMode(ChecksumMode mode) -> void { mChecksumMode = mode; }
+  // write the buffered chunks to the file
+  auto flush() -> std::error_code
+  {
+    auto lk = std::unique_lock(mRwMutex);
+    if (isClosed()) {
+      return SegmentErr::SegmentClosed;
+    }
+    return flushImpl(false);
+  }
   auto sync() -> std::error_code
   {
+    auto lk = std::unique_lock(mRwMutex);
     if (isClosed()) {
       return SegmentErr::SegmentClosed;
     }
+    if (auto err = flushImpl(false); err) {
+      return err;
+    }
     if (auto r = mFile.sync(); r != std::errc(0)) {
       return make_error_code(r);
     }
@@ -187,6 +354,9 @@ public:
   [[nodiscard]] auto size() const -> std::size_t { return mCurrentBlockNumber * kBlockSize + mCurrentBlockSize; }
   auto remove() -> bool
   {
+    auto lk = std::unique_lock(mRwMutex);
+    mMapping = nullptr;
+    mWriteBuffer.clear();
     if (!isClosed()) {
       if (!mFile.close()) {
         return false;
@@ -198,88 +368,232 @@ public:
     return true;
   }
   [[nodiscard]] auto isClosed() const -> bool { return mFile.isClosed(); }
+  [[nodiscard]] auto bufferedSize() const -> std::size_t { return mWriteBuffer.size(); }
   auto close() -> bool
   {
+    auto lk = std::unique_lock(mRwMutex);
+    mMapping = nullptr;
     if (!isClosed()) {
-      return mFile.close();
+      auto flushed = !flushImpl(false);
+      return mFile.close() && flushed;
     }
     return true;
   }
-  auto write(std::span<std::byte const> data) -> ext::expected<ChunkPosition, std::error_code>
+  // map the segment read-only once it will no longer be written, reads are then served from the
+  // page cache without a syscall and full chunks without a copy.
+  auto seal() -> std::error_code
+  {
+    auto lk = std::unique_lock(mRwMutex);
+    if (isClosed()) {
+      return SegmentErr::SegmentClosed;
+    }
+    if (mMapping != nullptr || size() == 0) {
+      return SegmentErr::Ok;
+    }
+    if (auto err = flushImpl(false); err) {
+      return err;
+    }
+    auto mapping = np_linux::Mapping::map(mFile, size());
+    if (!mapping) {
+      return make_error_code(mapping.error());
+    }
+    mMapping = std::make_shared<np_linux::Mapping>(std::move(mapping).value());
+    return SegmentErr::Ok;
+  }
+  [[nodiscard]] auto isSealed() const -> bool { return mMapping != nullptr; }
+  auto write(std::span<std::byte const> data, bool sync = false) -> ext::expected<ChunkPosition, std::error_code>
+  {
+    auto positions = writeAll(std::span(&data, 1), sync);
+    if (!positions) {
+      return ext::make_unexpected(positions.error());
+    }
+    return {positions->front()};
+  }
+  // lay out the chunks of every record against the current block boundary and append them all
+  // with a single call to the io backend, block padding is written inline as zero bytes. with a
+  // write buffer the chunks are copied into it instead and written once it fills up or `sync` is set.
+  auto writeAll(std::span<std::span<std::byte const> const> records, bool sync = false)
+      -> ext::expected<std::vector<ChunkPosition>, std::error_code>
   {
+    auto lk = std::unique_lock(mRwMutex);
     if (isClosed()) {
       return ext::make_unexpected(SegmentErr::SegmentClosed);
     }
-    if (mCurrentBlockSize + kChunkHeaderSize >= kBlockSize) {
-      if (mCurrentBlockSize < kBlockSize) {
-        auto padding = kBlockSize - mCurrentBlockSize;
-        if (auto r = mFile.truncate(size() + padding); r != std::errc(0)) {
-          return ext::make_unexpected(make_error_code(r));
+    static constexpr auto kPadding = std::array<std::byte, kChunkHeaderSize>{};
+    auto const prevBlockNumber = mCurrentBlockNumber;
+    auto const prevBlockSize = mCurrentBlockSize;
+
+    // headers and iovecs live in scratch buffers reused across appends, reserved up front for the worst
+    // case chunk count so the iovecs can point into them.
+    auto maxChunks = std::size_t(0);
+    for (auto data : records) {
+      maxChunks += data.size() / (kBlockSize - kChunkHeaderSize) + 2;
+    }
+    auto& headers = mHeaderScratch;
+    auto& iovs = mIovScratch;
+    headers.clear();
+    headers.reserve(maxChunks);
+    iovs.clear();
+    iovs.reserve(maxChunks * 2 + records.size());
+
+    auto positions = std::vector<ChunkPosition>();
+    positions.reserve(records.size());
+    for (auto data : records) {
+      if (mCurrentBlockSize + kChunkHeaderSize >= kBlockSize) {
+        if (mCurrentBlockSize < kBlockSize) {
+          auto padding = kBlockSize - mCurrentBlockSize;
+          iovs.push_back(iovec{const_cast<std::byte*>(kPadding.data()), padding});
         }
+        mCurrentBlockNumber++;
+        mCurrentBlockSize = 0;
       }
-      mCurrentBlockNumber++;
-      mCurrentBlockSize = 0;
-    }
 
-    auto position = ChunkPosition{mId, mCurrentBlockNumber, mCurrentBlockSize, static_cast<std::uint32_t>(data.size())};
-    auto dataSize = std::uint32_t(data.size());
-    if (mCurrentBlockSize + dataSize + kChunkHeaderSize <= kBlockSize) {
-      writeImpl(data, ChunkType::Full);
-      position.mChunkSize = dataSize + kChunkHeaderSize;
-      return {position};
+      auto position =
+          ChunkPosition{mId, mCurrentBlockNumber, mCurrentBlockSize, static_cast<std::uint32_t>(data.size())};
+      auto dataSize = std::uint32_t(data.size());
+      auto chunkCount = headers.size();
+      if (mCurrentBlockSize + dataSize + kChunkHeaderSize <= kBlockSize) {
+        writeImpl(headers, iovs, data, ChunkType::Full);
+      } else {
+        std::int64_t leftSize = dataSize;
+        while (leftSize > 0) {
+          auto chunkSize = kBlockSize - mCurrentBlockSize - kChunkHeaderSize;
+          if (chunkSize > leftSize) {
+            chunkSize = leftSize;
+          }
+          auto chunk = data.subspan(dataSize - leftSize, chunkSize);
+          if (leftSize == dataSize) {
+            writeImpl(headers, iovs, chunk, ChunkType::First);
+          } else if (leftSize == chunkSize) {
+            writeImpl(headers, iovs, chunk, ChunkType::Last);
+          } else {
+            writeImpl(headers, iovs, chunk, ChunkType::Middle);
+          }
+          leftSize -= chunkSize;
+        }
+      }
+      position.mChunkSize = (headers.size() - chunkCount) * kChunkHeaderSize + dataSize;
+      positions.push_back(position);
     }
 
-    std::int64_t leftSize = dataSize;
-    auto blockCount = std::uint32_t(0);
-    while (leftSize > 0) {
-      auto chunkSize = kBlockSize - mCurrentBlockSize - kChunkHeaderSize;
-      if (chunkSize > leftSize) {
-        chunkSize = leftSize;
-      }
-      auto chunk = Bytes(chunkSize);
-      auto end = dataSize - leftSize + chunkSize;
-      if (end > dataSize) {
-        end = dataSize;
+    if (mWriteBufferSize == 0 && mWriteBuffer.empty()) {
+      if (auto err = mIo->append(mFile, iovs, sync); err) {
+        // drop whatever part of the append made it to the file, so the segment stays consistent
+        invalidateCache(prevBlockNumber, mCurrentBlockNumber);
+        mCurrentBlockNumber = prevBlockNumber;
+        mCurrentBlockSize = prevBlockSize;
+        auto r = mFile.truncate(size());
+        assert(r == std::errc(0));
+        return ext::make_unexpected(err);
       }
-      enc::put(chunk.span(), data.subspan(dataSize - leftSize, chunkSize));
-      if (leftSize == dataSize) {
-        writeImpl(chunk.span(), ChunkType::First);
-      } else if (leftSize == chunkSize) {
-        writeImpl(chunk.span(), ChunkType::Last);
-      } else {
-        writeImpl(chunk.span(), ChunkType::Middle);
+      mFlushedSize = size();
+      return {std::move(positions)};
+    }
+
+    auto const prevBuffered = mWriteBuffer.size();
+    for (auto const& iov : iovs) {
+      auto data = static_cast<std::byte const*>(iov.iov_base);
+      mWriteBuffer.insert(mWriteBuffer.end(), data, data + iov.iov_len);
+    }
+    if (sync || mWriteBuffer.size() >= mWriteBufferSize) {
+      if (auto err = flushImpl(sync); err) {
+        // chunks buffered by earlier appends stay buffered, only this append is dropped
+        mWriteBuffer.resize(prevBuffered);
+        invalidateCache(prevBlockNumber, mCurrentBlockNumber);
+        mCurrentBlockNumber = prevBlockNumber;
+        mCurrentBlockSize = prevBlockSize;
+        return ext::make_unexpected(err);
       }
-      leftSize -= chunkSize;
-      blockCount++;
     }
-    position.mChunkSize = blockCount * kChunkHeaderSize + dataSize;
-    return {position};
+    return {std::move(positions)};
   }
 
-  auto read(std::uint32_t blockNumber, std::int64_t chunkOffset) -> ext::expected<Bytes, std::error_code>
+  auto read(std::uint32_t blockNumber, std::int64_t chunkOffset, ReadOption const& option = {})
+      -> ext::expected<Bytes, std::error_code>
   {
+    auto lk = std::shared_lock(mRwMutex);
     auto position = ChunkPosition{mId, blockNumber, chunkOffset, 0};
-    return readImpl(position);
+    return readImpl(position, option);
   }
-  auto reader() -> SegmentReader;
+  // read many chunks of this segment, the blocks they span are fetched with a single batched
+  // submission to the io backend before the chunks are decoded.
+  auto readMany(std::span<ChunkPosition const> positions, ReadOption const& option = {})
+      -> std::vector<ext::expected<Bytes, std::error_code>>
+  {
+    auto lk = std::shared_lock(mRwMutex);
+    auto results = std::vector<ext::expected<Bytes, std::error_code>>();
+    results.reserve(positions.size());
+    if (isClosed()) {
+      for (auto i = std::size_t(0); i < positions.size(); i++) {
+        results.push_back(ext::make_unexpected(SegmentErr::SegmentClosed));
+      }
+      return results;
+    }
+
+    auto prefetched = PrefetchedBlocks();
+    auto reads = std::vector<BlockRead>();
+    auto keys = std::vector<std::uint64_t>();
+    auto segSize = std::int64_t(size());
+    for (auto const& pos : positions) {
+      if (mMapping != nullptr) {
+        break;
+      }
+      auto lastBlock = pos.mBlockNumber;
+      if (pos.mChunkSize > 0) {
+        lastBlock = (pos.mBlockNumber * kBlockSize + pos.mChunkOffset + pos.mChunkSize - 1) / kBlockSize;
+      }
+      for (auto block = pos.mBlockNumber; block <= lastBlock; block++) {
+        std::int64_t offset = std::int64_t(block) * kBlockSize;
+        if (offset >= segSize || offset + std::int64_t(kBlockSize) > mFlushedSize ||
+            prefetched.contains(cacheKey(block))) {
+          continue;
+        }
+        if (mCache != nullptr && mCache->contains(cacheKey(block))) {
+          continue;
+        }
+        auto blockSize = std::min<std::int64_t>(kBlockSize, segSize - offset);
+        auto& buffer = prefetched[cacheKey(block)] = Bytes(blockSize);
+        reads.push_back(BlockRead{.offset = offset, .buffer = buffer.span()});
+        keys.push_back(cacheKey(block));
+      }
+    }
+    mIo->readBlocks(mFile, reads);
+    for (auto i = std::size_t(0); i < reads.size(); i++) {
+      // failed reads are retried, and reported, by the synchronous path
+      if (reads[i].result != std::int64_t(reads[i].buffer.size())) {
+        prefetched.erase(keys[i]);
+      } else if (mCache != nullptr && option.fillCache) {
+        auto const& block = prefetched[keys[i]];
+        if (mChecksumMode == ChecksumMode::Always || verifyBlock(block.span(), 0)) {
+          mCache->put(std::uint64_t(keys[i]), block.clone());
+        }
+      }
+    }
+
+    for (auto const& pos : positions) {
+      auto position = ChunkPosition{mId, pos.mBlockNumber, pos.mChunkOffset, 0};
+      results.push_back(readImpl(position, option, &prefetched));
+    }
+    return results;
+  }
+  auto reader(ReadOption const& option = {}) -> SegmentReader;
 
 private:
-  auto writeImpl(std::span<std::byte const> data, ChunkType type) -> std::error_code
+  using PrefetchedBlocks = std::unordered_map<std::uint64_t, Bytes>;
+
+  auto writeImpl(std::vector<ChunkHeader>& headers, std::vector<iovec>& iovs, std::span<std::byte const> data,
+                 ChunkType type) -> void
   {
     std::uint32_t const dataSize = data.size();
 
     auto header = ChunkHeader{};
     header.mLength = dataSize;
-    header.mType = type;
+    header.mType = ChunkType(std::uint8_t(type) | kChunkCrc32cFlag);
     header.mCrc = getChecksum(header, data);
-
-    if (auto r = mFile.write(&header, kChunkHeaderSize); !r) {
-      assert(r);
-    }
-
-    if (auto r = mFile.write(data); !r) {
-      assert(r);
-    }
+    assert(headers.size() < headers.capacity());
+    headers.push_back(header);
+    iovs.push_back(iovec{&headers.back(), kChunkHeaderSize});
+    iovs.push_back(iovec{const_cast<std::byte*>(data.data()), data.size()});
 
     if (mCurrentBlockSize > kBlockSize) {
       throw std::runtime_error("block size overflow");
@@ -290,11 +604,12 @@ private:
       mCurrentBlockNumber++;
       mCurrentBlockSize = 0;
     }
-    return SegmentErr::Ok;
   }
 
-  // if success, set position point to the next chunk
-  auto readImpl(ChunkPosition& position) -> ext::expected<Bytes, std::error_code>
+  // if success, set position point to the next chunk. with `measure` only the head of the chunk is read,
+  // once it is complete the blocks of the rest are stepped over unread and unverified.
+  auto readImpl(ChunkPosition& position, ReadOption const& option = {}, PrefetchedBlocks const* prefetched = nullptr,
+                ChunkHeadFn const* measure = nullptr) -> ext::expected<Bytes, std::error_code>
   {
     if (isClosed()) {
       return ext::make_unexpected(SegmentErr::SegmentClosed);
@@ -305,34 +620,55 @@ private:
     auto segSize = size();
     auto nextChunk = ChunkPosition{mId};
     auto result = Buffer();
+    auto full = Bytes();
     for (;;) {
       std::int64_t size = kBlockSize;
       std::int64_t offset = blockNumber * kBlockSize;
-      Bytes* cachedBlockPtr = nullptr;
       if (kBlockSize + offset > segSize) {
         size = segSize - offset;
       }
       if (chunkOffset >= size) {
         return ext::make_unexpected(SegmentErr::EndOfSegment);
       }
-      if (mCache) {
-        cachedBlockPtr = mCache->get(cacheKey(blockNumber));
-      }
       auto cacheBlock = Bytes();
-      if (cachedBlockPtr != nullptr) {
-        cacheBlock = cachedBlockPtr->clone();
+      // blocks in the cache were verified when they were loaded
+      auto verified = false;
+      if (mMapping != nullptr) {
+        cacheBlock = Bytes(size, std::shared_ptr<std::byte[]>(mMapping, mMapping->data() + offset));
+      } else if (auto block = findPrefetched(prefetched, blockNumber); block != nullptr && std::int64_t(block->capacity()) >= size) {
+        cacheBlock = block->clone();
       } else {
-        if (auto r = mFile.seek(offset, File::Set); r != std::errc(0)) {
-          return ext::make_unexpected(make_error_code(r));
+        auto cached = std::optional<Bytes>();
+        if (mCache != nullptr) {
+          cached = option.fillCache ? mCache->get(cacheKey(blockNumber)) : mCache->peek(cacheKey(blockNumber));
         }
-        cacheBlock = Bytes(size);
-
-        auto r = mFile.read(cacheBlock.span());
-        assert(r);
-        assert(mFile.eof() == false);
-
-        if (mCache != nullptr && size == kBlockSize && cachedBlockPtr == nullptr) {
-          mCache->put(cacheKey(blockNumber), cacheBlock.clone());
+        if (cached.has_value() && std::int64_t(cached->capacity()) >= size) {
+          cacheBlock = std::move(cached).value();
+          verified = mChecksumMode == ChecksumMode::OnLoad;
+        } else {
+          // a cached tail block the segment has grown past is extended with just the appended bytes
+          std::int64_t cachedSize = cached.has_value() ? cached->capacity() : 0;
+          cacheBlock = Bytes(size);
+          if (cachedSize > 0) {
+            std::copy_n(cached->data(), cachedSize, cacheBlock.data());
+          }
+          auto r = readBlock(cacheBlock.span().subspan(cachedSize), offset + cachedSize);
+          if (!r) {
+            return ext::make_unexpected(std::error_code(errno, std::system_category()));
+          }
+          if (std::int64_t(*r) != size - cachedSize) {
+            return ext::make_unexpected(SegmentErr::EndOfSegment);
+          }
+
+          if (mCache != nullptr && option.fillCache) {
+            if (mChecksumMode == ChecksumMode::OnLoad) {
+              if (!verifyBlock(cacheBlock.span(), cachedSize)) {
+                return ext::make_unexpected(SegmentErr::InvalidCheckSum);
+              }
+              verified = true;
+            }
+            mCache->put(cacheKey(blockNumber), cacheBlock.clone());
+          }
         }
       }
       auto header = ChunkHeader();
@@ -340,17 +676,23 @@ private:
                std::span((std::byte*)&header, kChunkHeaderSize));
       auto start = chunkOffset + kChunkHeaderSize;
       auto length = header.mLength;
-      result.extendCapacity(length);
-      result.append(cacheBlock.span().subspan(start, length));
       auto checksumEnd = chunkOffset + kChunkHeaderSize + length;
-      auto checksum = getChecksum(header, cacheBlock.span().subspan(chunkOffset + kChunkHeaderSize, length));
-      auto savedChecksum = header.mCrc;
-      if (checksum != savedChecksum) {
-        return ext::make_unexpected(SegmentErr::InvalidCheckSum);
+      if (!verified) {
+        auto checksum = getChecksum(header, cacheBlock.span().subspan(chunkOffset + kChunkHeaderSize, length));
+        if (checksum != header.mCrc) {
+          return ext::make_unexpected(SegmentErr::InvalidCheckSum);
+        }
+      }
+      // a full chunk of a mapped segment is handed out as a view of the mapping, no copy needed
+      auto type = chunkType(header);
+      if (mMapping != nullptr && type == ChunkType::Full) {
+        full = cacheBlock.slice(start, length);
+      } else {
+        result.extendCapacity(length);
+        result.append(cacheBlock.span().subspan(start, length));
       }
 
-      auto chunkType = header.mType;
-      if (chunkType == ChunkType::Full || chunkType == ChunkType::Last) {
+      if (type == ChunkType::Full || type == ChunkType::Last) {
         nextChunk.mBlockNumber = blockNumber;
         nextChunk.mChunkOffset = checksumEnd;
 
@@ -360,44 +702,207 @@ private:
         }
         break;
       }
+      if (measure != nullptr) {
+        auto head = (*measure)(result.span().first(result.size()));
+        if (head.has_value() && head->head <= result.size() && head->size > result.size()) {
+          // the rest follows as one chunk per block from the next block on, all but the last filling it
+          constexpr auto kPayload = kBlockSize - kChunkHeaderSize;
+          auto left = head->size - result.size();
+          auto blocks = (left + kPayload - 1) / kPayload;
+          auto lastEnd = kChunkHeaderSize + left - (blocks - 1) * kPayload;
+          // a record torn by a crash ends past the end of the segment
+          if (std::int64_t(blockNumber + blocks) * kBlockSize + std::int64_t(lastEnd) > segSize) {
+            return ext::make_unexpected(SegmentErr::EndOfSegment);
+          }
+          nextChunk.mBlockNumber = blockNumber + blocks;
+          nextChunk.mChunkOffset = lastEnd;
+          if (lastEnd + kChunkHeaderSize >= kBlockSize) {
+            nextChunk.mBlockNumber++;
+            nextChunk.mChunkOffset = 0;
+          }
+          break;
+        }
+      }
       blockNumber++;
       chunkOffset = 0;
     }
     position = nextChunk;
+    if (full.data() != nullptr) {
+      return {std::move(full)};
+    }
     return {result};
   }
 
+  // read `dst.size()` bytes at `offset`, the part that is still in the write buffer is copied from it
+  auto readBlock(std::span<std::byte> dst, std::int64_t offset) -> std::optional<std::size_t>
+  {
+    auto const fileSize = std::clamp<std::int64_t>(mFlushedSize - offset, 0, dst.size());
+    auto n = mFile.readAt(dst.first(fileSize), offset);
+    if (!n || *n != std::size_t(fileSize)) {
+      return n;
+    }
+    auto const bufferStart = offset + fileSize - mFlushedSize;
+    auto const bufferSize = std::min<std::int64_t>(dst.size() - fileSize, mWriteBuffer.size() - bufferStart);
+    std::copy_n(mWriteBuffer.begin() + bufferStart, bufferSize, dst.begin() + fileSize);
+    return fileSize + bufferSize;
+  }
+  // write the buffered chunks with one call to the io backend
+  auto flushImpl(bool sync) -> std::error_code
+  {
+    if (mWriteBuffer.empty()) {
+      if (sync) {
+        if (auto r = mFile.sync(); r != std::errc(0)) {
+          return make_error_code(r);
+        }
+      }
+      return SegmentErr::Ok;
+    }
+    auto iov = iovec{mWriteBuffer.data(), mWriteBuffer.size()};
+    if (auto err = mIo->append(mFile, std::span(&iov, 1), sync); err) {
+      auto r = mFile.truncate(mFlushedSize);
+      assert(r == std::errc(0));
+      return err;
+    }
+    mFlushedSize += mWriteBuffer.size();
+    mWriteBuffer.clear();
+    return SegmentErr::Ok;
+  }
+
+  // check every chunk of `block` that starts at or after `from`, which must be a chunk boundary
+  static auto verifyBlock(std::span<std::byte const> block, std::size_t from) -> bool
+  {
+    auto offset = from;
+    // no more than a header's worth of bytes left at the end of a full block are padding
+    while (offset < block.size() && (block.size() < kBlockSize || offset + kChunkHeaderSize < kBlockSize)) {
+      if (offset + kChunkHeaderSize > block.size()) {
+        return false;
+      }
+      auto header = ChunkHeader();
+      enc::get(block.subspan(offset, kChunkHeaderSize), std::span((std::byte*)&header, kChunkHeaderSize));
+      auto start = offset + kChunkHeaderSize;
+      if (start + header.mLength > block.size()) {
+        return false;
+      }
+      if (getChecksum(header, block.subspan(start, header.mLength)) != header.mCrc) {
+        return false;
+      }
+      offset = start + header.mLength;
+    }
+    return true;
+  }
+
+  // forget the cached blocks in [from, to], their contents beyond the segment size are rolled back
+  auto invalidateCache(std::uint32_t from, std::uint32_t to) -> void
+  {
+    if (mCache == nullptr) {
+      return;
+    }
+    for (auto block = from; block <= to; block++) {
+      mCache->remove(cacheKey(block));
+    }
+  }
+
+  // read the whole blocks of [firstBlock, firstBlock + bytes) that are already in the file with one
+  // call, and ask the kernel to start fetching the window after it.
+  auto readahead(std::uint32_t firstBlock, std::size_t bytes, PrefetchedBlocks& blocks) -> void
+  {
+    blocks.clear();
+    auto const offset = std::int64_t(firstBlock) * std::int64_t(kBlockSize);
+    auto const segSize = std::int64_t(size());
+    auto const count = std::max<std::size_t>(bytes / kBlockSize, 1);
+    auto end = std::min<std::int64_t>(offset + count * kBlockSize, mFlushedSize);
+    if (end < segSize) {
+      end -= end % kBlockSize;
+    }
+    if (end <= offset) {
+      return;
+    }
+    auto window = Bytes(end - offset);
+    if (auto r = mFile.readAt(window.span(), offset); !r || *r != window.capacity()) {
+      return;
+    }
+    for (auto block = offset; block < end; block += kBlockSize) {
+      auto blockNumber = std::uint32_t(block / kBlockSize);
+      blocks[cacheKey(blockNumber)] = window.slice(block - offset, std::min<std::int64_t>(kBlockSize, end - block));
+    }
+    mFile.advise(end, std::int64_t(count * kBlockSize), POSIX_FADV_WILLNEED);
+  }
+
+  auto findPrefetched(PrefetchedBlocks const* prefetched, std::uint32_t blockNumber) -> Bytes const*
+  {
+    if (prefetched == nullptr) {
+      return nullptr;
+    }
+    auto it = prefetched->find(cacheKey(blockNumber));
+    return it == prefetched->end() ? nullptr : &it->second;
+  }
+
   auto cacheKey(std::uint32_t blockNumber) -> std::uint64_t
   {
     return std::uint64_t(mId) << 32 | std::uint64_t(blockNumber);
   }
 
   SegmentID mId;
-  File mFile;
+  np_linux::File mFile;
   std::string mFilePath;
   std::uint32_t mCurrentBlockNumber;
   std::uint32_t mCurrentBlockSize;
-  std::shared_ptr<Cache<std::uint64_t, Bytes>> mCache;
+  std::shared_ptr<BlockCache> mCache;
+  std::shared_ptr<np_linux::Mapping> mMapping;
+  std::shared_ptr<IoBackend> mIo;
+  std::vector<ChunkHeader> mHeaderScratch;
+  std::vector<iovec> mIovScratch;
+  // chunks appended after file offset `mFlushedSize` that are not written to the file yet
+  std::vector<std::byte> mWriteBuffer;
+  std::size_t mWriteBufferSize = 0;
+  std::int64_t mFlushedSize = 0;
+  ChecksumMode mChecksumMode = ChecksumMode::Always;
+  // shared by reads, exclusive while chunks are appended, flushed or the file is closed. readers that
+  // do not go through the wal, like an iterator, rely on it. the private helpers expect it held.
+  mutable std::shared_mutex mRwMutex;
 
   friend class SegmentReader;
 };
 
 class SegmentReader {
 public:
-  SegmentReader(Segment* segment, std::uint32_t blockNumber, std::int64_t mChunkOffset)
-      : mSegment(segment), mBlockNumber(blockNumber), mChunkOffset(mChunkOffset)
+  SegmentReader(Segment* segment, std::uint32_t blockNumber, std::int64_t mChunkOffset, ReadOption option = {})
+      : mSegment(segment), mBlockNumber(blockNumber), mChunkOffset(mChunkOffset), mOption(option)
   {
+    if (mOption.readahead > 0) {
+      mReadahead = std::make_shared<Segment::PrefetchedBlocks>();
+      mSegment->mFile.advise(0, 0, POSIX_FADV_SEQUENTIAL);
+    }
   }
   SegmentReader(SegmentReader const&) = default;
   auto id() const -> SegmentID { return mSegment->mId; }
-  auto next(ChunkPosition& position) -> ext::expected<Bytes, std::error_code>
+  auto next(ChunkPosition& position) -> ext::expected<Bytes, std::error_code> { return nextImpl(position, nullptr); }
+  // like `next`, but only the head of the chunk that `measure` asks for is read and the blocks holding
+  // nothing but the rest of it are skipped. the returned bytes start with the head and may hold more.
+  auto nextHead(ChunkPosition& position, ChunkHeadFn const& measure) -> ext::expected<Bytes, std::error_code>
   {
+    return nextImpl(position, &measure);
+  }
+  [[nodiscard]] auto blockNumber() const -> std::uint32_t { return mBlockNumber; }
+  [[nodiscard]] auto chunkOffset() const -> std::int64_t { return mChunkOffset; }
+
+private:
+  auto nextImpl(ChunkPosition& position, ChunkHeadFn const* measure) -> ext::expected<Bytes, std::error_code>
+  {
+    auto lk = std::shared_lock(mSegment->mRwMutex);
     if (mSegment->isClosed()) {
       return ext::make_unexpected(SegmentErr::SegmentClosed);
     }
     position = ChunkPosition{mSegment->mId, mBlockNumber, mChunkOffset};
 
-    auto result = mSegment->readImpl(position);
+    auto prefetched = static_cast<Segment::PrefetchedBlocks const*>(nullptr);
+    if (mReadahead != nullptr && !mSegment->isSealed()) {
+      if (!mReadahead->contains(mSegment->cacheKey(mBlockNumber))) {
+        mSegment->readahead(mBlockNumber, mOption.readahead, *mReadahead);
+      }
+      prefetched = mReadahead.get();
+    }
+    auto result = mSegment->readImpl(position, mOption, prefetched, measure);
     if (!result) {
       return ext::make_unexpected(result.error());
     }
@@ -409,13 +914,13 @@ public:
     position.mChunkSize = chunkSize; // setup chunk size
     return {std::move(result).value()};
   }
-  [[nodiscard]] auto blockNumber() const -> std::uint32_t { return mBlockNumber; }
-  [[nodiscard]] auto chunkOffset() const -> std::int64_t { return mChunkOffset; }
 
-private:
   Segment* mSegment;
   std::uint32_t mBlockNumber;
   std::int64_t mChunkOffset;
+  ReadOption mOption;
+  // blocks fetched ahead of the reader, copies of a reader share them
+  std::shared_ptr<Segment::PrefetchedBlocks> mReadahead;
 };
 
-inline auto Segment::reader() -> SegmentReader { return SegmentReader(this, 0, 0); }
+inline auto Segment::reader(ReadOption const& option) -> SegmentReader { return SegmentReader(this, 0, 0, option); }
@@ -2,6 +2,7 @@
 
 #include "../db.hpp"
 #include "ramdom_data.hpp"
+#include <thread>
 auto destroyDB(Database* db)
 {
   std::filesystem::remove_all(db->getOption().dirPath);
@@ -234,4 +235,201 @@ TEST(Batch, Rollback)
   ASSERT_FALSE(v);
   ASSERT_TRUE(v.error() == DbErr::KeyNotFound);
   destroyDB(db.get());
-}
\ No newline at end of file
+}
+
+TEST(Batch, ConcurrentCommit)
+{
+  auto opt = DbOption{};
+  opt.segmentSize = 4 * MiB;
+  opt.syncWrite = true;
+  auto r = Database::open(opt);
+  if (!r) {
+    throw std::system_error(r.error());
+  }
+  auto db = std::move(r).value();
+
+  constexpr auto kThreads = 8;
+  constexpr auto kBatches = 50;
+  constexpr auto kBatchSize = 10;
+  auto values = std::vector<Bytes>(kThreads * kBatches * kBatchSize);
+  auto threads = std::vector<std::thread>();
+  for (auto t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t] {
+      for (auto b = 0; b < kBatches; b++) {
+        auto batch = db->newBatch(BatchOption{});
+        for (auto i = 0; i < kBatchSize; i++) {
+          auto n = (t * kBatches + b) * kBatchSize + i;
+          values[n] = genValueBytes(n % 3000);
+          auto e = batch->put(getKeyBytes(n), values[n]);
+          ASSERT_FALSE(e);
+        }
+        auto e = batch->commit();
+        ASSERT_FALSE(e);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto validate = [&](Database& db) {
+    for (auto n = 0; n < values.size(); n++) {
+      auto v = db.get(getKeyBytes(n));
+      ASSERT_TRUE(v);
+      ASSERT_EQ(*v, values[n]);
+    }
+  };
+  validate(*db);
+  db->close();
+
+  auto dr = Database::open(opt);
+  auto db2 = std::move(dr).value();
+  validate(*db2);
+  db2->close();
+  destroyDB(db.get());
+}
+
+TEST(Batch, ReadWhileWriteBatchOpen)
+{
+  auto opt = DbOption{};
+  auto r = Database::open(opt);
+  if (!r) {
+    throw std::system_error(r.error());
+  }
+  auto db = std::move(r).value();
+  genData(*db, 0, 100, 128);
+
+  // an open write batch does not hold readers back
+  auto batch = db->newBatch(BatchOption{});
+  ASSERT_FALSE(batch->put(getKeyBytes(1000), genValueBytes(128)));
+  auto reader = std::thread([&] {
+    for (auto i = 0; i < 100; i++) {
+      ASSERT_TRUE(db->get(getKeyBytes(i)));
+    }
+    auto v = db->get(getKeyBytes(1000));
+    ASSERT_FALSE(v);
+    ASSERT_TRUE(v.error() == DbErr::KeyNotFound);
+  });
+  reader.join();
+  ASSERT_FALSE(batch->commit());
+  ASSERT_TRUE(db->get(getKeyBytes(1000)));
+  db->close();
+  destroyDB(db.get());
+}
+
+TEST(Batch, BytesViewKeys)
+{
+  auto opt = DbOption{};
+  auto r = Database::open(opt);
+  if (!r) {
+    throw std::system_error(r.error());
+  }
+  auto db = std::move(r).value();
+  using namespace std::literals;
+  ASSERT_FALSE(db->put("view-key"sv, "view-value"sv));
+  auto stored = std::string("view-key");
+  auto v = db->get(std::string_view(stored));
+  ASSERT_TRUE(v);
+  ASSERT_EQ(*v, Bytes::from("view-value"));
+  ASSERT_TRUE(db->exist(Bytes::from("view-key")).value());
+  ASSERT_TRUE(db->get(""sv).error() == DbErr::KeyEmpty);
+
+  // pending writes are found by a view of other storage than their key
+  auto batch = db->newBatch(BatchOption{});
+  ASSERT_FALSE(batch->put(Bytes::from("pending"), Bytes::from("1")));
+  auto pending = std::array<char, 7>{'p', 'e', 'n', 'd', 'i', 'n', 'g'};
+  auto key = BytesView(std::as_bytes(std::span(pending)));
+  ASSERT_EQ(batch->get(key).value(), Bytes::from("1"));
+  ASSERT_FALSE(batch->del("view-key"sv));
+  ASSERT_FALSE(batch->exist("view-key"sv).value());
+  ASSERT_FALSE(batch->del(key));
+  ASSERT_FALSE(batch->exist(key).value());
+  ASSERT_FALSE(batch->commit());
+  ASSERT_TRUE(db->get("view-key"sv).error() == DbErr::KeyNotFound);
+  ASSERT_TRUE(db->get(key).error() == DbErr::KeyNotFound);
+  db->close();
+  destroyDB(db.get());
+}
+
+TEST(Batch, AtomicToReaders)
+{
+  auto opt = DbOption{};
+  auto r = Database::open(opt);
+  if (!r) {
+    throw std::system_error(r.error());
+  }
+  auto db = std::move(r).value();
+  // every batch moves 16 values from one half of the keys to the other, a reader never sees both
+  // halves or neither
+  constexpr int kPairs = 16;
+  auto keys = std::vector<Bytes>();
+  for (int i = 0; i < kPairs * 2; i++) {
+    keys.push_back(getKeyBytes(i));
+  }
+  for (int i = 0; i < kPairs; i++) {
+    ASSERT_FALSE(db->put(keys[i], genValueBytes(16)));
+  }
+  auto done = std::atomic_bool(false);
+  auto writer = std::thread([&] {
+    for (int round = 0; round < 2000; round++) {
+      auto from = round % 2 == 0 ? 0 : kPairs;
+      auto to = kPairs - from;
+      auto batch = db->newBatch(BatchOption{});
+      for (int i = 0; i < kPairs; i++) {
+        ASSERT_FALSE(batch->del(keys[from + i]));
+        ASSERT_FALSE(batch->put(keys[to + i], genValueBytes(16)));
+      }
+      ASSERT_FALSE(batch->commit());
+    }
+    done = true;
+  });
+  auto readers = std::vector<std::thread>();
+  for (int t = 0; t < 2; t++) {
+    readers.emplace_back([&] {
+      while (!done) {
+        auto results = db->multiGet(keys);
+        auto found = std::array<int, 2>();
+        for (int i = 0; i < kPairs * 2; i++) {
+          found[i / kPairs] += results[i].has_value();
+        }
+        ASSERT_TRUE((found[0] == kPairs && found[1] == 0) || (found[0] == 0 && found[1] == kPairs));
+      }
+    });
+  }
+  writer.join();
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  db->close();
+  destroyDB(db.get());
+}
+
+TEST(Batch, DeleteAfterGroupCommit)
+{
+  auto opt = DbOption{};
+  auto r = Database::open(opt);
+  if (!r) {
+    throw std::system_error(r.error());
+  }
+  auto db = std::move(r).value();
+  // the second batch starts once the first one is appended, it must see its put before that is applied
+  for (int i = 0; i < 300; i++) {
+    auto key = getKeyBytes(i);
+    auto put = db->newBatch(BatchOption{.syncWrite = true, .readOnly = false});
+    ASSERT_FALSE(put->put(key, genValueBytes(16)));
+    auto deleter = std::thread([&] {
+      auto del = db->newBatch(BatchOption{.syncWrite = false, .readOnly = false});
+      ASSERT_FALSE(del->del(key));
+      ASSERT_TRUE(del->exist(key).has_value());
+      ASSERT_FALSE(del->exist(key).value());
+      ASSERT_FALSE(del->commit());
+    });
+    ASSERT_FALSE(put->commit());
+    deleter.join();
+    auto value = db->get(key);
+    ASSERT_FALSE(value.has_value());
+    ASSERT_TRUE(value.error() == DbErr::KeyNotFound);
+  }
+  db->close();
+  destroyDB(db.get());
+}
@@ -0,0 +1,62 @@
+#include "../cache.hpp"
+#include <gtest/gtest.h>
+
+TEST(Cache, TinyLfuScanResistant)
+{
+  auto cache = ShardedCache<std::uint64_t, int>(100, 0, 1, CachePolicy::TinyLfu);
+  auto const hot = 50;
+  for (auto round = 0; round < 5; round++) {
+    for (auto key = std::uint64_t(0); key < hot; key++) {
+      if (!cache.get(key)) {
+        cache.put(key, int(key));
+      }
+    }
+  }
+  // a scan touches every key once
+  for (auto key = std::uint64_t(1000); key < 11000; key++) {
+    if (!cache.get(key)) {
+      cache.put(key, int(key));
+    }
+  }
+  ASSERT_LE(cache.size(), cache.capacity());
+  auto kept = 0;
+  for (auto key = std::uint64_t(0); key < hot; key++) {
+    if (auto value = cache.get(key); value) {
+      ASSERT_EQ(*value, key);
+      kept++;
+    }
+  }
+  ASSERT_GE(kept, hot * 9 / 10);
+}
+
+TEST(Cache, LruScanEvictsHot)
+{
+  auto cache = ShardedCache<std::uint64_t, int>(100, 0, 1, CachePolicy::Lru);
+  for (auto key = std::uint64_t(0); key < 50; key++) {
+    cache.put(key, int(key));
+  }
+  for (auto key = std::uint64_t(1000); key < 1100; key++) {
+    cache.put(key, int(key));
+  }
+  for (auto key = std::uint64_t(0); key < 50; key++) {
+    ASSERT_FALSE(cache.get(key).has_value());
+  }
+  auto stats = cache.stats();
+  ASSERT_EQ(stats.size(), 1);
+  ASSERT_EQ(stats[0].misses, 50);
+  ASSERT_EQ(stats[0].evictions, 50);
+}
+
+TEST(Cache, TinyLfuRemoveAndClear)
+{
+  auto cache = ShardedCache<std::uint64_t, int>(64, 0, 4, CachePolicy::TinyLfu);
+  for (auto key = std::uint64_t(0); key < 64; key++) {
+    cache.put(key, int(key));
+  }
+  ASSERT_TRUE(cache.contains(3));
+  ASSERT_EQ(cache.remove(3), 3);
+  ASSERT_FALSE(cache.contains(3));
+  ASSERT_FALSE(cache.remove(3).has_value());
+  cache.clear();
+  ASSERT_TRUE(cache.empty());
+}
@@ -0,0 +1,41 @@
+#include "../crc32.hpp"
+#include <gtest/gtest.h>
+
+#include <string_view>
+#include <vector>
+
+using namespace std::literals;
+
+TEST(Crc32c, KnownValues)
+{
+  auto check = std::as_bytes(std::span("123456789"sv));
+  ASSERT_EQ(crc32c(check), 0xE3069283);
+  ASSERT_EQ(crc32c(std::span<std::byte const>()), 0);
+
+  auto zeros = std::vector<std::byte>(32);
+  ASSERT_EQ(crc32c(zeros), 0x8A9136AA);
+  auto ones = std::vector<std::byte>(32, std::byte(0xFF));
+  ASSERT_EQ(crc32c(ones), 0x62A8AB43);
+}
+
+TEST(Crc32c, SoftwareMatchesDispatch)
+{
+  auto data = std::vector<std::byte>(4096 + 16);
+  for (auto i = std::size_t(0); i < data.size(); i++) {
+    data[i] = std::byte(i * 131 + 7);
+  }
+  for (auto offset = 0; offset < 8; offset++) {
+    for (auto len : {0, 1, 3, 7, 8, 9, 15, 63, 100, 1024, 4096}) {
+      auto expected = ~detail::crc32cSoftware(data.data() + offset, len, ~0u);
+      ASSERT_EQ(crc32c(data.data() + offset, len), expected);
+    }
+  }
+}
+
+TEST(Crc32c, Chained)
+{
+  auto data = std::as_bytes(std::span("the quick brown fox jumps over the lazy dog"sv));
+  for (auto split = std::size_t(0); split <= data.size(); split++) {
+    ASSERT_EQ(crc32c(data.subspan(split), crc32c(data.first(split))), crc32c(data));
+  }
+}
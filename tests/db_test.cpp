@@ -2,6 +2,8 @@
 
 #include "../db.hpp"
 #include "ramdom_data.hpp"
+#include <fcntl.h>
+#include <fstream>
 
 auto destroyDB(Database& db)
 {
@@ -21,3 +23,608 @@ auto genValueBytes(int n) -> Bytes
   auto [data, len] = randomValue(n);
   return Bytes{len, std::move(data)};
 }
+
+TEST(DB, MultiGet)
+{
+  auto opt = DbOption{};
+  opt.dirPath = std::filesystem::temp_directory_path() / "db-test-multi-get";
+  opt.segmentSize = 8 * MiB;
+  opt.ioType = IoType::IoUring;
+  std::filesystem::create_directories(opt.dirPath);
+
+  auto r = Database::open(opt);
+  ASSERT_TRUE(r);
+  auto db = std::move(r).value();
+
+  auto values = std::vector<Bytes>();
+  for (int i = 0; i < 1000; i++) {
+    values.push_back(genValueBytes(i * 17 % (40 * KiB)));
+    ASSERT_FALSE(db->put(getKeyBytes(i), values.back()));
+  }
+
+  auto keys = std::vector<Bytes>();
+  for (int i = 999; i >= 0; i -= 3) {
+    keys.push_back(getKeyBytes(i));
+  }
+  keys.push_back(getKeyBytes(5000));
+  keys.push_back(Bytes());
+
+  auto results = db->multiGet(keys);
+  ASSERT_EQ(results.size(), keys.size());
+  for (int i = 0; i + 2 < keys.size(); i++) {
+    ASSERT_TRUE(results[i].has_value());
+    ASSERT_EQ(*results[i], values[999 - i * 3]);
+  }
+  ASSERT_TRUE(results[keys.size() - 2].error() == DbErr::KeyNotFound);
+  ASSERT_TRUE(results[keys.size() - 1].error() == DbErr::KeyEmpty);
+
+  destroyDB(*db);
+}
+
+TEST(DB, RecoverAcrossSegments)
+{
+  auto opt = DbOption{};
+  opt.dirPath = std::filesystem::temp_directory_path() / "db-test-recover-across-segments";
+  opt.segmentSize = 1 * MiB;
+  std::filesystem::remove_all(opt.dirPath);
+  std::filesystem::create_directories(opt.dirPath);
+
+  auto r = Database::open(opt);
+  ASSERT_TRUE(r);
+  auto db = std::move(r).value();
+
+  auto values = std::unordered_map<int, Bytes>();
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 300; i++) {
+      values[i] = genValueBytes(4 * KiB + round);
+      ASSERT_FALSE(db->put(getKeyBytes(i), values[i]));
+    }
+  }
+  // a batch large enough to span several segments, with a Finished marker in the last one
+  auto batch = db->newBatch(BatchOption{});
+  for (int i = 0; i < 300; i += 2) {
+    values[i] = genValueBytes(16 * KiB);
+    ASSERT_FALSE(batch->put(getKeyBytes(i), values[i]));
+  }
+  for (int i = 1; i < 300; i += 10) {
+    ASSERT_FALSE(batch->del(getKeyBytes(i)));
+    values.erase(i);
+  }
+  ASSERT_FALSE(batch->commit());
+  db->close();
+
+  for (auto threads : {1u, 4u}) {
+    opt.recoveryThreads = threads;
+    auto dr = Database::open(opt);
+    ASSERT_TRUE(dr);
+    auto db2 = std::move(dr).value();
+    for (int i = 0; i < 300; i++) {
+      auto v = db2->get(getKeyBytes(i));
+      if (values.contains(i)) {
+        ASSERT_TRUE(v);
+        ASSERT_EQ(*v, values[i]);
+      } else {
+        ASSERT_TRUE(v.error() == DbErr::KeyNotFound);
+      }
+    }
+    db2->close();
+  }
+
+  destroyDB(*db);
+}
+
+TEST(DB, SegmentHints)
+{
+  auto opt = DbOption{};
+  opt.dirPath = std::filesystem::temp_directory_path() / "db-test-segment-hints";
+  opt.segmentSize = 1 * MiB;
+  std::filesystem::remove_all(opt.dirPath);
+  std::filesystem::create_directories(opt.dirPath);
+
+  auto hintPath = [&](SegmentID id) {
+    return segmentFileName(opt.dirPath.native(), kSegmentHintFileNameSuffix, id);
+  };
+  auto values = std::unordered_map<int, Bytes>();
+  {
+    auto r = Database::open(opt);
+    ASSERT_TRUE(r);
+    auto db = std::move(r).value();
+    for (int i = 0; i < 1000; i++) {
+      values[i % 400] = genValueBytes(4 * KiB + i % 7);
+      ASSERT_FALSE(db->put(getKeyBytes(i % 400), values[i % 400]));
+    }
+    for (int i = 0; i < 400; i += 9) {
+      ASSERT_FALSE(db->del(getKeyBytes(i)));
+      values.erase(i);
+    }
+    // the hints are written in the background
+    for (int i = 0; i < 500 && !std::filesystem::exists(hintPath(3)); i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    db->close();
+  }
+  ASSERT_TRUE(std::filesystem::exists(hintPath(1)));
+  ASSERT_TRUE(std::filesystem::exists(hintPath(3)));
+  // a hint that was not finished is written again, the rest are read instead of their segments
+  std::filesystem::remove(hintPath(2));
+
+  auto r = Database::open(opt);
+  ASSERT_TRUE(r);
+  auto db = std::move(r).value();
+  for (int i = 0; i < 400; i++) {
+    auto v = db->get(getKeyBytes(i));
+    if (values.contains(i)) {
+      ASSERT_TRUE(v);
+      ASSERT_EQ(*v, values[i]);
+    } else {
+      ASSERT_TRUE(v.error() == DbErr::KeyNotFound);
+    }
+  }
+  for (int i = 0; i < 500 && !std::filesystem::exists(hintPath(2)); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_TRUE(std::filesystem::exists(hintPath(2)));
+
+  destroyDB(*db);
+}
+
+TEST(DB, IndexCheckpoint)
+{
+  auto opt = DbOption{};
+  opt.dirPath = std::filesystem::temp_directory_path() / "db-test-index-checkpoint";
+  opt.segmentSize = 1 * MiB;
+  opt.segmentHints = false;
+  std::filesystem::remove_all(opt.dirPath);
+  std::filesystem::create_directories(opt.dirPath);
+
+  auto values = std::unordered_map<int, Bytes>();
+  auto check = [&](Database& db) {
+    for (int i = 0; i < 200; i++) {
+      auto v = db.get(getKeyBytes(i));
+      if (values.contains(i)) {
+        ASSERT_TRUE(v);
+        ASSERT_EQ(*v, values[i]);
+      } else {
+        ASSERT_TRUE(v.error() == DbErr::KeyNotFound);
+      }
+    }
+  };
+  {
+    auto r = Database::open(opt);
+    ASSERT_TRUE(r);
+    auto db = std::move(r).value();
+    for (int round = 0; round < 3; round++) {
+      for (int i = 0; i < 200; i++) {
+        values[i] = genValueBytes(4 * KiB + round);
+        ASSERT_FALSE(db->put(getKeyBytes(i), values[i]));
+      }
+    }
+    db->close();
+  }
+  ASSERT_TRUE(std::filesystem::exists(opt.dirPath / kCheckpointFileName));
+
+  // nothing in the first segment is live any more, with the checkpoint it is never read
+  {
+    auto path = segmentFileName(opt.dirPath.native(), kDataFileNameSuffix, 1);
+    auto fd = ::open(path.c_str(), O_WRONLY);
+    ASSERT_NE(fd, -1);
+    auto garbage = std::array<std::byte, 4>{std::byte(0xde), std::byte(0xad), std::byte(0xbe), std::byte(0xef)};
+    ASSERT_EQ(::pwrite(fd, garbage.data(), garbage.size(), 0), garbage.size());
+    ::close(fd);
+  }
+  {
+    auto r = Database::open(opt);
+    ASSERT_TRUE(r);
+    auto db = std::move(r).value();
+    check(*db);
+    // written after the checkpoint and dropped without close, replayed from the log on the next open
+    for (int i = 0; i < 200; i += 3) {
+      values[i] = genValueBytes(100);
+      ASSERT_FALSE(db->put(getKeyBytes(i), values[i]));
+    }
+    for (int i = 1; i < 200; i += 7) {
+      ASSERT_FALSE(db->del(getKeyBytes(i)));
+      values.erase(i);
+    }
+    ASSERT_FALSE(db->sync());
+  }
+  {
+    auto r = Database::open(opt);
+    ASSERT_TRUE(r);
+    auto db = std::move(r).value();
+    check(*db);
+    db->close();
+  }
+
+  // a damaged checkpoint is dropped and the whole log is scanned, which finds the damaged segment. the
+  // key count is damaged too, the load must not reserve the index for it.
+  {
+    auto file = std::fstream(opt.dirPath / kCheckpointFileName, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(40);
+    file.put('x');
+    file.seekp(20);
+    for (int i = 0; i < 8; i++) {
+      file.put(char(0x7f));
+    }
+  }
+  ASSERT_FALSE(Database::open(opt).has_value());
+  ASSERT_FALSE(std::filesystem::exists(opt.dirPath / kCheckpointFileName));
+
+  std::filesystem::remove_all(opt.dirPath);
+}
+
+TEST(DB, CheckpointWhileWriting)
+{
+  auto opt = DbOption{};
+  opt.dirPath = std::filesystem::temp_directory_path() / "db-test-checkpoint-while-writing";
+  opt.segmentSize = 1 * MiB;
+  opt.segmentHints = false;
+  std::filesystem::remove_all(opt.dirPath);
+  std::filesystem::create_directories(opt.dirPath);
+
+  auto values = std::vector<Bytes>(2000);
+  {
+    auto r = Database::open(opt);
+    ASSERT_TRUE(r);
+    auto db = std::move(r).value();
+    for (int i = 0; i < 1000; i++) {
+      values[i] = genValueBytes(512);
+      ASSERT_FALSE(db->put(getKeyBytes(i), values[i]));
+    }
+    // keys are added and removed while the index is written, the entry count in the header is stale
+    auto writer = std::thread([&] {
+      for (int i = 1000; i < 2000; i++) {
+        values[i] = genValueBytes(512);
+        ASSERT_FALSE(db->put(getKeyBytes(i), values[i]));
+        ASSERT_FALSE(db->del(getKeyBytes(i - 1000)));
+      }
+    });
+    for (int i = 0; i < 20; i++) {
+      ASSERT_FALSE(db->checkpoint());
+    }
+    writer.join();
+    ASSERT_FALSE(db->sync());
+  }
+  ASSERT_TRUE(loadIndexCheckpoint(opt.dirPath / kCheckpointFileName, opt.indexType).has_value());
+
+  auto r = Database::open(opt);
+  ASSERT_TRUE(r);
+  auto db = std::move(r).value();
+  for (int i = 0; i < 2000; i++) {
+    auto v = db->get(getKeyBytes(i));
+    if (i < 1000) {
+      ASSERT_TRUE(v.error() == DbErr::KeyNotFound);
+    } else {
+      ASSERT_TRUE(v);
+      ASSERT_EQ(*v, values[i]);
+    }
+  }
+  destroyDB(*db);
+}
+
+TEST(DB, MergeHintFile)
+{
+  auto opt = DbOption{};
+  opt.dirPath = std::filesystem::temp_directory_path() / "db-test-merge-hint-file";
+  opt.segmentSize = 1 * MiB;
+  opt.segmentHints = false;
+  opt.indexCheckpoint = false;
+  std::filesystem::remove_all(opt.dirPath);
+  std::filesystem::remove_all(mergeDirPath(opt.dirPath));
+  std::filesystem::create_directories(opt.dirPath);
+
+  auto values = std::unordered_map<int, Bytes>();
+  auto check = [&](Database& db) {
+    for (int i = 0; i < 300; i++) {
+      auto v = db.get(getKeyBytes(i));
+      if (values.contains(i)) {
+        ASSERT_TRUE(v);
+        ASSERT_EQ(*v, values[i]);
+      } else {
+        ASSERT_TRUE(v.error() == DbErr::KeyNotFound);
+      }
+    }
+  };
+  {
+    auto r = Database::open(opt);
+    ASSERT_TRUE(r);
+    auto db = std::move(r).value();
+    for (int round = 0; round < 3; round++) {
+      for (int i = 0; i < 300; i++) {
+        values[i] = genValueBytes(4 * KiB + round);
+        ASSERT_FALSE(db->put(getKeyBytes(i), values[i]));
+      }
+    }
+    for (int i = 0; i < 300; i += 11) {
+      ASSERT_FALSE(db->del(getKeyBytes(i)));
+      values.erase(i);
+    }
+    ASSERT_FALSE(db->merge(true));
+    check(*db);
+    // the keys deleted before the merge are compacted out of the index
+    auto memory = db->memoryStat();
+    ASSERT_EQ(memory.keyCount, values.size());
+    ASSERT_EQ(memory.deadKeyBytes, 0);
+    db->close();
+  }
+
+  auto hintPath = segmentFileName(opt.dirPath.native(), kHintFileNameSuffix, 1);
+  auto reader = HintReader::open(hintPath);
+  ASSERT_TRUE(reader);
+  ASSERT_EQ(reader->entryCount(), values.size());
+  auto entry = HintEntry();
+  auto count = std::size_t(0);
+  for (auto more = reader->next(entry); more.value(); more = reader->next(entry)) {
+    ASSERT_NE(entry.position.mChunkSize, 0);
+    count++;
+  }
+  ASSERT_EQ(count, values.size());
+
+  auto r = Database::open(opt);
+  ASSERT_TRUE(r);
+  auto db = std::move(r).value();
+  check(*db);
+  destroyDB(*db);
+}
+
+TEST(DB, ScanOrderedIndex)
+{
+  auto opt = DbOption{};
+  opt.dirPath = std::filesystem::temp_directory_path() / "db-test-scan";
+  opt.indexType = IndexType::Art;
+  std::filesystem::remove_all(opt.dirPath);
+  std::filesystem::create_directories(opt.dirPath);
+
+  auto key = [](int tenant, int i) {
+    auto buf = std::array<char, 32>();
+    auto n = std::snprintf(buf.data(), buf.size(), "tenant:%02d:%04d", tenant, i);
+    return Bytes::from(std::string_view(buf.data(), n));
+  };
+  auto toString = [](Bytes const& bytes) { return std::string((char const*)bytes.data(), bytes.capacity()); };
+  auto scanKeys = [&](Database& db, ScanOption const& option) {
+    auto keys = std::vector<std::string>();
+    auto err = db.scan(option, [&](Bytes const& k, Bytes const& v) {
+      EXPECT_EQ(toString(v), "v" + toString(k));
+      keys.push_back(toString(k));
+      return true;
+    });
+    EXPECT_FALSE(err);
+    return keys;
+  };
+  auto check = [&](Database& db) {
+    // more keys than one batch of the scan
+    auto tenant = scanKeys(db, ScanOption{.prefix = Bytes::from("tenant:07:")});
+    ASSERT_EQ(tenant.size(), 500);
+    ASSERT_TRUE(std::is_sorted(tenant.begin(), tenant.end()));
+    ASSERT_EQ(tenant.front(), toString(key(7, 0)));
+    ASSERT_EQ(tenant.back(), toString(key(7, 998)));
+
+    auto reversed = scanKeys(db, ScanOption{.prefix = Bytes::from("tenant:07:"), .reverse = true});
+    std::reverse(reversed.begin(), reversed.end());
+    ASSERT_EQ(reversed, tenant);
+
+    auto range = scanKeys(db, ScanOption{.low = key(3, 10), .high = key(3, 20)});
+    ASSERT_EQ(range, (std::vector<std::string>{toString(key(3, 10)), toString(key(3, 12)), toString(key(3, 14)),
+                                               toString(key(3, 16)), toString(key(3, 18))}));
+    ASSERT_EQ(scanKeys(db, ScanOption{}).size(), 10 * 500);
+  };
+  {
+    auto r = Database::open(opt);
+    ASSERT_TRUE(r);
+    auto db = std::move(r).value();
+    for (int tenant = 0; tenant < 10; tenant++) {
+      for (int i = 0; i < 1000; i++) {
+        auto k = key(tenant, i);
+        ASSERT_FALSE(db->put(k, Bytes::from("v" + toString(k))));
+      }
+      for (int i = 1; i < 1000; i += 2) {
+        ASSERT_FALSE(db->del(key(tenant, i)));
+      }
+    }
+    check(*db);
+    auto visited = 0;
+    ASSERT_FALSE(db->scan(ScanOption{}, [&](Bytes const&, Bytes const&) { return ++visited < 3; }));
+    ASSERT_EQ(visited, 3);
+    db->close();
+  }
+  // the index comes back ordered from the checkpoint, and from the log
+  for (auto checkpoint : {true, false}) {
+    opt.indexCheckpoint = checkpoint;
+    auto r = Database::open(opt);
+    ASSERT_TRUE(r);
+    auto db = std::move(r).value();
+    check(*db);
+    db->close();
+  }
+
+  opt.indexType = IndexType::Hash;
+  auto r = Database::open(opt);
+  ASSERT_TRUE(r);
+  auto db = std::move(r).value();
+  ASSERT_TRUE(db->scan(ScanOption{}, [](Bytes const&, Bytes const&) { return true; }) == DbErr::IndexNotOrdered);
+  destroyDB(*db);
+}
+
+TEST(DB, ScanCallbackWrites)
+{
+  auto opt = DbOption{};
+  opt.dirPath = std::filesystem::temp_directory_path() / "db-test-scan-writes";
+  opt.indexType = IndexType::Art;
+  std::filesystem::remove_all(opt.dirPath);
+  std::filesystem::create_directories(opt.dirPath);
+  auto r = Database::open(opt);
+  ASSERT_TRUE(r);
+  auto db = std::move(r).value();
+
+  // several batches of the scan, the callback deletes every key it is handed
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_FALSE(db->put(getKeyBytes(i), genValueBytes(16)));
+  }
+  auto visited = 0;
+  auto err = db->scan(ScanOption{}, [&](Bytes const& k, Bytes const&) {
+    EXPECT_FALSE(db->del(k));
+    visited++;
+    return true;
+  });
+  ASSERT_FALSE(err);
+  ASSERT_EQ(visited, 1000);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(db->get(getKeyBytes(i)).error(), DbErr::KeyNotFound);
+  }
+  destroyDB(*db);
+}
+
+TEST(DB, IteratorPinsSegments)
+{
+  auto opt = DbOption{};
+  opt.dirPath = std::filesystem::temp_directory_path() / "db-test-iterator";
+  opt.segmentSize = 1 * MiB;
+  std::filesystem::remove_all(opt.dirPath);
+  std::filesystem::remove_all(mergeDirPath(opt.dirPath));
+  std::filesystem::create_directories(opt.dirPath);
+
+  auto r = Database::open(opt);
+  ASSERT_TRUE(r);
+  auto db = std::move(r).value();
+  auto values = std::unordered_map<Bytes, Bytes, BytesHash, BytesEqual>();
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 300; i++) {
+      values[getKeyBytes(i)] = genValueBytes(4 * KiB + round);
+      ASSERT_FALSE(db->put(getKeyBytes(i), values[getKeyBytes(i)]));
+    }
+  }
+  for (int i = 0; i < 300; i += 7) {
+    ASSERT_FALSE(db->del(getKeyBytes(i)));
+    values.erase(getKeyBytes(i));
+  }
+
+  auto keyOnly = db->newIterator(IteratorOption{.keyOnly = true});
+  auto one = db->newIterator(IteratorOption{.prefetch = 1});
+  auto all = db->newIterator(IteratorOption{.prefetch = 1000, .fillCache = true});
+  ASSERT_TRUE(keyOnly && one && all);
+  // the merge removes the segments the iterators read from, and the values change after it
+  ASSERT_FALSE(db->merge(true));
+  for (int i = 0; i < 300; i++) {
+    ASSERT_FALSE(db->put(getKeyBytes(i), genValueBytes(100)));
+  }
+
+  auto keys = std::size_t(0);
+  for (auto& iter = *keyOnly; iter->valid(); iter->next()) {
+    ASSERT_TRUE(values.contains(iter->key()));
+    ASSERT_TRUE(iter->value().error() == DbErr::KeyOnlyIterator);
+    keys++;
+  }
+  ASSERT_EQ(keys, values.size());
+  for (auto* iter : {one->get(), all->get()}) {
+    ASSERT_EQ(iter->size(), values.size());
+    for (; iter->valid(); iter->next()) {
+      auto v = iter->value();
+      ASSERT_TRUE(v);
+      ASSERT_EQ(*v, values.find(iter->key())->second);
+    }
+  }
+  keyOnly->reset();
+  one->reset();
+  all->reset();
+  destroyDB(*db);
+  ASSERT_TRUE(db->newIterator().error() == DbErr::DBClosed);
+}
+
+TEST(DB, IteratorSeesWholeBatches)
+{
+  for (auto type : {IndexType::Hash, IndexType::Art}) {
+    auto opt = DbOption{};
+    opt.dirPath = std::filesystem::temp_directory_path() / "db-test-iterator-batches";
+    opt.indexType = type;
+    std::filesystem::remove_all(opt.dirPath);
+    std::filesystem::create_directories(opt.dirPath);
+    auto r = Database::open(opt);
+    ASSERT_TRUE(r);
+    auto db = std::move(r).value();
+
+    // every batch moves the values of one half of the keys to the other, a snapshot holds one half
+    constexpr int kPairs = 300;
+    auto keys = std::vector<Bytes>();
+    for (int i = 0; i < kPairs * 2; i++) {
+      keys.push_back(getKeyBytes(i));
+    }
+    for (int i = 0; i < kPairs; i++) {
+      ASSERT_FALSE(db->put(keys[i], genValueBytes(16)));
+    }
+    auto done = std::atomic_bool(false);
+    auto writer = std::thread([&] {
+      for (int round = 0; round < 200; round++) {
+        auto from = round % 2 == 0 ? 0 : kPairs;
+        auto to = kPairs - from;
+        auto batch = db->newBatch(BatchOption{.syncWrite = false, .readOnly = false});
+        for (int i = 0; i < kPairs; i++) {
+          ASSERT_FALSE(batch->del(keys[from + i]));
+          ASSERT_FALSE(batch->put(keys[to + i], genValueBytes(16)));
+        }
+        ASSERT_FALSE(batch->commit());
+      }
+      done = true;
+    });
+    auto halves = std::unordered_map<Bytes, int, BytesHash, BytesEqual>();
+    for (int i = 0; i < kPairs * 2; i++) {
+      halves[keys[i]] = i / kPairs;
+    }
+    while (!done) {
+      auto iter = db->newIterator(IteratorOption{.keyOnly = true});
+      ASSERT_TRUE(iter);
+      auto found = std::array<int, 2>();
+      for (auto& it = *iter; it->valid(); it->next()) {
+        found[halves.find(it->key())->second]++;
+      }
+      ASSERT_TRUE((found[0] == kPairs && found[1] == 0) || (found[0] == 0 && found[1] == kPairs));
+    }
+    writer.join();
+    destroyDB(*db);
+  }
+}
+
+TEST(DB, IteratorWhileWriting)
+{
+  auto opt = DbOption{};
+  opt.dirPath = std::filesystem::temp_directory_path() / "db-test-iterator-writes";
+  opt.segmentSize = 4 * MiB;
+  opt.writeBufferSize = 512 * KiB;
+  opt.blockCache = 0;
+  std::filesystem::remove_all(opt.dirPath);
+  std::filesystem::create_directories(opt.dirPath);
+
+  auto r = Database::open(opt);
+  ASSERT_TRUE(r);
+  auto db = std::move(r).value();
+  auto values = std::unordered_map<Bytes, Bytes, BytesHash, BytesEqual>();
+  for (int i = 0; i < 300; i++) {
+    values[getKeyBytes(i)] = genValueBytes(1 * KiB + i);
+    ASSERT_FALSE(db->put(getKeyBytes(i), values[getKeyBytes(i)]));
+  }
+
+  // the iterators read the active segment, at first all of it still in the write buffer, while the
+  // writer appends to it, flushes it and rotates it away
+  auto done = std::atomic_bool(false);
+  auto writer = std::thread([&] {
+    for (int i = 0; i < 10000; i++) {
+      ASSERT_FALSE(db->put(getKeyBytes(1000 + i), genValueBytes(1 * KiB)));
+    }
+    done = true;
+  });
+  while (!done) {
+    auto iter = db->newIterator(IteratorOption{.prefetch = 4});
+    ASSERT_TRUE(iter);
+    auto count = std::size_t(0);
+    for (auto& it = *iter; it->valid(); it->next()) {
+      if (auto found = values.find(it->key()); found != values.end()) {
+        auto v = it->value();
+        ASSERT_TRUE(v);
+        ASSERT_EQ(*v, found->second);
+        count++;
+      }
+    }
+    ASSERT_EQ(count, values.size());
+  }
+  writer.join();
+  destroyDB(*db);
+}
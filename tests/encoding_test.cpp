@@ -81,3 +81,21 @@ TEST(Encoding, PutGet)
   ASSERT_EQ(pull, 0x9078563412000000);
   ASSERT_EQ(arr[8], 0x8);
 }
+
+TEST(Encoding, Varint)
+{
+  auto buf = std::array<std::byte, enc::kMaxVarintSize>();
+  for (auto value : {0ull, 1ull, 127ull, 128ull, 300ull, 16383ull, 16384ull, 0xffffffffull, ~0ull}) {
+    auto n = enc::putVarint(buf, value);
+    auto decoded = std::uint64_t();
+    ASSERT_EQ(enc::getVarint(std::span(buf).first(n), decoded), n);
+    ASSERT_EQ(decoded, value);
+    if (n > 1) {
+      // a truncated varint is rejected
+      ASSERT_EQ(enc::getVarint(std::span(buf).first(n - 1), decoded), 0);
+    }
+  }
+  ASSERT_EQ(enc::putVarint(buf, 127), 1);
+  ASSERT_EQ(enc::putVarint(buf, 128), 2);
+  ASSERT_EQ(enc::putVarint(buf, ~0ull), enc::kMaxVarintSize);
+}
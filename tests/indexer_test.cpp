@@ -0,0 +1,256 @@
+#include "../indexer.hpp"
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <thread>
+
+auto indexKey(std::uint64_t i) -> Bytes { return Bytes::from("key-" + std::to_string(i)); }
+
+TEST(Indexer, SwissMapMatchesUnorderedMap)
+{
+  auto index = SwissMap();
+  auto expected = std::unordered_map<std::uint64_t, ChunkPosition>();
+  auto rng = std::mt19937_64(42);
+  for (auto op = 0; op < 200000; op++) {
+    auto key = rng() % 20000;
+    switch (rng() % 4) {
+    case 0:
+    case 1: {
+      auto position = ChunkPosition{SegmentID(rng() % 100), std::uint32_t(op), std::int64_t(key), 7};
+      index.put(indexKey(key), position);
+      expected[key] = position;
+      break;
+    }
+    case 2:
+      ASSERT_EQ(index.del(indexKey(key)), expected.erase(key) == 1);
+      break;
+    default: {
+      auto position = index.get(indexKey(key));
+      if (auto it = expected.find(key); it != expected.end()) {
+        ASSERT_TRUE(position.has_value());
+        ASSERT_EQ(*position, it->second);
+      } else {
+        ASSERT_FALSE(position.has_value());
+      }
+    }
+    }
+    ASSERT_EQ(index.size(), expected.size());
+  }
+
+  auto seen = std::size_t(0);
+  index.forEach([&](std::span<std::byte const> key, ChunkPosition const& position) {
+    auto pos = index.get(Bytes::from(key));
+    ASSERT_TRUE(pos.has_value());
+    ASSERT_EQ(*pos, position);
+    seen++;
+  });
+  ASSERT_EQ(seen, expected.size());
+}
+
+TEST(Indexer, SwissMapReserveAndMove)
+{
+  auto index = SwissMap();
+  index.reserve(1000);
+  for (auto i = std::uint64_t(0); i < 1000; i++) {
+    index.put(indexKey(i), ChunkPosition{1, std::uint32_t(i), 0, 0});
+  }
+  // deleting and inserting again reuses deleted slots instead of growing forever
+  for (auto round = 0; round < 50; round++) {
+    for (auto i = std::uint64_t(0); i < 1000; i++) {
+      ASSERT_TRUE(index.del(indexKey(i)));
+      index.put(indexKey(i), ChunkPosition{2, std::uint32_t(i), 0, 0});
+    }
+  }
+  auto moved = std::move(index);
+  ASSERT_EQ(moved.size(), 1000);
+  ASSERT_EQ(index.size(), 0);
+  ASSERT_FALSE(index.get(indexKey(1)).has_value());
+  for (auto i = std::uint64_t(0); i < 1000; i++) {
+    auto pos = moved.getPtr(indexKey(i));
+    ASSERT_NE(pos, nullptr);
+    ASSERT_EQ(pos->unpack().mSegmentID, 2);
+    ASSERT_EQ(pos->unpack().mBlockNumber, i);
+  }
+}
+
+TEST(Indexer, ShardedIndexConcurrentReadersAndWriters)
+{
+  auto index = ShardedIndex();
+  index.reserve(4000);
+  for (auto i = std::uint64_t(0); i < 4000; i++) {
+    index.put(indexKey(i), ChunkPosition{1, std::uint32_t(i), 0, 0});
+  }
+  auto threads = std::vector<std::thread>();
+  auto misses = std::atomic<int>(0);
+  for (auto t = 0; t < 4; t++) {
+    // writers move their own quarter of the keys to a new position, readers must always find every key
+    threads.emplace_back([&, t] {
+      for (auto round = 0; round < 20; round++) {
+        for (auto i = std::uint64_t(t); i < 4000; i += 4) {
+          index.put(indexKey(i), ChunkPosition{SegmentID(2 + round), std::uint32_t(i), 0, 0});
+        }
+      }
+    });
+    threads.emplace_back([&] {
+      for (auto round = 0; round < 20; round++) {
+        for (auto i = std::uint64_t(0); i < 4000; i++) {
+          auto pos = index.get(indexKey(i));
+          if (!pos.has_value() || pos->mBlockNumber != i) {
+            misses++;
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(misses.load(), 0);
+  ASSERT_EQ(index.size(), 4000);
+  index.forEach([](std::span<std::byte const>, ChunkPosition const& position) { ASSERT_EQ(position.mSegmentID, 21); });
+  ASSERT_TRUE(index.del(indexKey(7)));
+  ASSERT_FALSE(index.contains(indexKey(7)));
+}
+
+TEST(Indexer, ArtTreeMatchesMap)
+{
+  // short keys over a small alphabet, so keys are often prefixes of each other and nodes of every size occur
+  auto rng = std::mt19937_64(7);
+  auto randomKey = [&] {
+    auto key = std::string();
+    auto len = 1 + rng() % 6;
+    for (auto i = 0u; i < len; i++) {
+      key.push_back(i < 2 ? char(rng() % 256) : "abc"[rng() % 3]);
+    }
+    return key;
+  };
+  auto tree = ArtTree();
+  auto expected = std::map<std::string, ChunkPosition>();
+  auto toString = [](std::span<std::byte const> key) { return std::string((char const*)key.data(), key.size()); };
+  auto checkRange = [&](std::string const& low, std::string const& high, bool reverse) {
+    auto want = std::vector<std::string>();
+    for (auto& [key, pos] : expected) {
+      if ((low.empty() || key >= low) && (high.empty() || key < high)) {
+        want.push_back(key);
+      }
+    }
+    if (reverse) {
+      std::reverse(want.begin(), want.end());
+    }
+    auto got = std::vector<std::string>();
+    auto visit = [&](std::span<std::byte const> key, ChunkPosition const&) {
+      got.push_back(toString(key));
+      return true;
+    };
+    auto lowBytes = Bytes::from(low);
+    auto highBytes = Bytes::from(high);
+    if (reverse) {
+      tree.descend(lowBytes.span(), highBytes.span(), visit);
+    } else {
+      tree.ascend(lowBytes.span(), highBytes.span(), visit);
+    }
+    ASSERT_EQ(got, want);
+  };
+
+  for (auto op = 0; op < 100000; op++) {
+    auto key = randomKey();
+    if (rng() % 3 != 0) {
+      auto position = ChunkPosition{1, std::uint32_t(op), 0, 0};
+      tree.put(Bytes::from(key).span(), position);
+      expected[key] = position;
+    } else {
+      auto removed = tree.remove(Bytes::from(key).span());
+      auto it = expected.find(key);
+      ASSERT_EQ(removed.has_value(), it != expected.end());
+      if (it != expected.end()) {
+        ASSERT_EQ(*removed, it->second);
+        expected.erase(it);
+      }
+    }
+    ASSERT_EQ(tree.size(), expected.size());
+    if (op % 5000 == 0) {
+      auto a = randomKey();
+      auto b = randomKey();
+      checkRange(std::min(a, b), std::max(a, b), false);
+      checkRange(std::min(a, b), std::max(a, b), true);
+      checkRange(a, "", rng() % 2 == 0);
+      checkRange("", b, rng() % 2 == 0);
+    }
+  }
+  for (auto const& [key, pos] : expected) {
+    auto got = tree.get(Bytes::from(key).span());
+    ASSERT_TRUE(got.has_value());
+    ASSERT_EQ(*got, pos);
+  }
+  checkRange("", "", false);
+  checkRange("", "", true);
+  // a scan stops when it is told to
+  auto count = 0;
+  tree.ascend({}, {}, [&](std::span<std::byte const>, ChunkPosition const&) { return ++count < 10; });
+  ASSERT_EQ(count, 10);
+  for (auto const& [key, pos] : std::map(expected)) {
+    ASSERT_TRUE(tree.remove(Bytes::from(key).span()).has_value());
+  }
+  ASSERT_EQ(tree.size(), 0);
+}
+
+TEST(Indexer, PackedPosition)
+{
+  auto positions = std::vector<ChunkPosition>{
+      {1, 0, 0, 0},
+      {kMaxSegmentID, (1u << kPackedBlockBits) - 1, kBlockSize - kChunkHeaderSize - 1, ~0u},
+      {12345, 67890, 4321, 1 * MiB},
+  };
+  auto rng = std::mt19937_64(7);
+  for (auto i = 0; i < 1000; i++) {
+    positions.push_back(ChunkPosition{SegmentID(rng() & kMaxSegmentID), std::uint32_t(rng() % (1u << kPackedBlockBits)),
+                                      std::int64_t(rng() % kBlockSize), std::uint32_t(rng())});
+  }
+  for (auto const& position : positions) {
+    ASSERT_TRUE(PackedPosition::fits(position));
+    auto unpacked = PackedPosition(position).unpack();
+    ASSERT_EQ(unpacked, position);
+    ASSERT_EQ(unpacked.mChunkSize, position.mChunkSize);
+  }
+  ASSERT_FALSE(PackedPosition::fits(ChunkPosition{kMaxSegmentID + 1, 0, 0, 0}));
+  ASSERT_FALSE(PackedPosition::fits(ChunkPosition{1, 1u << kPackedBlockBits, 0, 0}));
+  ASSERT_FALSE(PackedPosition::fits(ChunkPosition{1, 0, kBlockSize, 0}));
+}
+
+TEST(Indexer, KeyArena)
+{
+  auto longKey = [](std::uint64_t i) { return Bytes::from("a-key-longer-than-fifteen-bytes-" + std::to_string(i)); };
+  for (auto type : {IndexType::Hash, IndexType::Art}) {
+    auto index = Indexer(type);
+    for (auto i = std::uint64_t(0); i < 100000; i++) {
+      index.put(i % 2 == 0 ? indexKey(i) : longKey(i), ChunkPosition{1, std::uint32_t(i), 0, 0});
+    }
+    auto before = index.memoryStat();
+    ASSERT_EQ(before.keyCount, 100000);
+    ASSERT_EQ(before.deadKeyBytes, 0);
+    // with a shared Bytes per key a slot alone took 48 bytes, besides the key's own allocation
+    auto overhead = (before.indexBytes - before.keyBytes) / before.keyCount;
+    ASSERT_LT(overhead, type == IndexType::Hash ? 48 : 80);
+
+    for (auto i = std::uint64_t(0); i < 100000; i += 4) {
+      ASSERT_TRUE(index.del(indexKey(i)));
+      ASSERT_TRUE(index.del(longKey(i + 1)));
+    }
+    auto removed = index.memoryStat();
+    ASSERT_EQ(removed.keyCount, 50000);
+    ASSERT_GT(removed.deadKeyBytes, 0);
+    index.compact();
+    auto compacted = index.memoryStat();
+    ASSERT_EQ(compacted.deadKeyBytes, 0);
+    ASSERT_EQ(compacted.keyBytes, removed.keyBytes);
+    ASSERT_LT(compacted.indexBytes, removed.indexBytes);
+    for (auto i = std::uint64_t(0); i < 100000; i++) {
+      auto key = i % 2 == 0 ? indexKey(i) : longKey(i);
+      auto pos = index.get(key);
+      ASSERT_EQ(pos.has_value(), i % 4 >= 2);
+      if (pos) {
+        ASSERT_EQ(pos->mBlockNumber, i);
+      }
+    }
+  }
+}
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
+#include <atomic>
 #include <random>
+#include <thread>
 
 #include "../segment.hpp"
 
@@ -190,7 +192,7 @@ TEST(Segment, ManyChunksFull)
 {
   auto dir = fs::temp_directory_path() / "seg-test-reader-ManyChunks_FULL";
   fs::create_directories(dir);
-  auto cache = std::make_shared<Cache<std::uint64_t, Bytes>>(5, 2);
+  auto cache = std::make_shared<BlockCache>(5 * kBlockSize, 2 * kBlockSize);
   auto seg = Segment(dir.string(), ".SIG", 1, cache);
 
   auto const data = std::vector<std::byte>(128, std::byte(0x23));
@@ -221,4 +223,416 @@ TEST(Segment, ManyChunksFull)
   seg.remove();
 
   removeDir(dir);
-}
\ No newline at end of file
+}
+
+TEST(Segment, ConcurrentRead)
+{
+  auto dir = fs::temp_directory_path() / "seg-test-concurrent-read";
+  fs::create_directories(dir);
+  auto seg = Segment(dir.string(), ".SIG", 1, nullptr);
+
+  auto positions = std::vector<ChunkPosition>();
+  for (auto i = 0; i < 2000; i++) {
+    auto const data = std::vector<std::byte>(100 + i * 37 % kBlockSize, std::byte(i % 256));
+    auto pos = seg.write(data);
+    ASSERT_TRUE(pos.has_value());
+    positions.push_back(*pos);
+  }
+
+  auto failed = std::atomic_int(0);
+  auto threads = std::vector<std::thread>();
+  for (auto t = 0; t < 8; t++) {
+    threads.emplace_back([&, t] {
+      for (auto i = t; i < positions.size(); i += 3) {
+        auto v = seg.read(positions[i].mBlockNumber, positions[i].mChunkOffset);
+        auto const data = std::vector<std::byte>(100 + i * 37 % kBlockSize, std::byte(i % 256));
+        if (!v.has_value() || !(v->span() == data)) {
+          failed++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(failed.load(), 0);
+  seg.remove();
+
+  removeDir(dir);
+}
+
+TEST(Segment, WriteAll)
+{
+  auto dir = fs::temp_directory_path() / "seg-test-write-all";
+  fs::create_directories(dir);
+  auto seg = Segment(dir.string(), ".SIG", 1, nullptr);
+
+  auto values = std::vector<std::vector<std::byte>>{
+      std::vector<std::byte>(kBlockSize - kChunkHeaderSize - 3, std::byte(1)), // leaves room only for padding
+      std::vector<std::byte>(100, std::byte(2)),
+      std::vector<std::byte>(kBlockSize * 2 + 100, std::byte(3)),
+      std::vector<std::byte>(0),
+      std::vector<std::byte>(kBlockSize - kChunkHeaderSize, std::byte(4)),
+  };
+  auto records = std::vector<std::span<std::byte const>>(values.begin(), values.end());
+  auto positions = seg.writeAll(records);
+  ASSERT_TRUE(positions.has_value());
+  ASSERT_EQ(positions->size(), values.size());
+  ASSERT_EQ((*positions)[1].mBlockNumber, 1);
+  ASSERT_EQ((*positions)[1].mChunkOffset, 0);
+
+  auto single = seg.write(values[1]);
+  ASSERT_TRUE(single.has_value());
+  positions->push_back(*single);
+  values.push_back(values[1]);
+
+  for (auto i = 0; i < values.size(); i++) {
+    auto v = seg.read((*positions)[i].mBlockNumber, (*positions)[i].mChunkOffset);
+    ASSERT_TRUE(v.has_value());
+    ASSERT_TRUE(v->span() == std::span<std::byte const>(values[i]));
+  }
+
+  auto reader = seg.reader();
+  for (auto i = 0; i < values.size(); i++) {
+    auto rpos = ChunkPosition();
+    auto v = reader.next(rpos);
+    ASSERT_TRUE(v.has_value());
+    ASSERT_EQ(rpos, (*positions)[i]);
+  }
+  seg.remove();
+
+  removeDir(dir);
+}
+
+TEST(Segment, ConcurrentReadSharedCache)
+{
+  auto dir = fs::temp_directory_path() / "seg-test-concurrent-read-cache";
+  fs::create_directories(dir);
+  auto cache = std::make_shared<BlockCache>(8 * kBlockSize, 2 * kBlockSize, 4);
+  auto seg = Segment(dir.string(), ".SIG", 1, cache);
+
+  auto positions = std::vector<ChunkPosition>();
+  for (auto i = 0; i < 2000; i++) {
+    auto const data = std::vector<std::byte>(100 + i * 37 % kBlockSize, std::byte(i % 256));
+    auto pos = seg.write(data);
+    ASSERT_TRUE(pos.has_value());
+    positions.push_back(*pos);
+  }
+
+  auto failed = std::atomic_int(0);
+  auto threads = std::vector<std::thread>();
+  for (auto t = 0; t < 8; t++) {
+    threads.emplace_back([&, t] {
+      for (auto i = t; i < positions.size(); i += 3) {
+        auto v = seg.read(positions[i].mBlockNumber, positions[i].mChunkOffset);
+        auto const data = std::vector<std::byte>(100 + i * 37 % kBlockSize, std::byte(i % 256));
+        if (!v.has_value() || !(v->span() == data)) {
+          failed++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(failed.load(), 0);
+
+  ASSERT_EQ(cache->shardCount(), 4);
+  auto total = CacheStats();
+  for (auto const& shard : cache->stats()) {
+    total.hits += shard.hits;
+    total.misses += shard.misses;
+    total.evictions += shard.evictions;
+  }
+  ASSERT_GT(total.hits, 0);
+  ASSERT_GT(total.misses, 0);
+  ASSERT_GT(total.evictions, 0);
+  ASSERT_LE(cache->weight(), cache->capacity() + 2 * kBlockSize);
+  seg.remove();
+
+  removeDir(dir);
+}
+
+TEST(Segment, ReadWithoutFillCache)
+{
+  auto dir = fs::temp_directory_path() / "seg-test-no-fill-cache";
+  fs::create_directories(dir);
+  auto cache = std::make_shared<BlockCache>(16 * kBlockSize, 0, 1);
+  auto seg = Segment(dir.string(), ".SIG", 1, cache);
+
+  auto const data = std::vector<std::byte>(1000, std::byte(0x23));
+  auto positions = std::vector<ChunkPosition>();
+  for (auto i = 0; i < 200; i++) {
+    auto pos = seg.write(data);
+    ASSERT_TRUE(pos.has_value());
+    positions.push_back(*pos);
+  }
+
+  auto noFill = ReadOption{.fillCache = false};
+  auto reader = seg.reader(noFill);
+  for (;;) {
+    auto rpos = ChunkPosition();
+    auto v = reader.next(rpos);
+    if (!v.has_value()) {
+      ASSERT_TRUE(v.error() == SegmentErr::EndOfSegment);
+      break;
+    }
+    ASSERT_TRUE(v->span() == data);
+  }
+  ASSERT_TRUE(cache->empty());
+
+  // blocks that are already cached are still used
+  ASSERT_TRUE(seg.read(positions[0].mBlockNumber, positions[0].mChunkOffset).has_value());
+  ASSERT_EQ(cache->size(), 1);
+  auto hits = cache->stats()[0].hits;
+  ASSERT_TRUE(seg.read(positions[1].mBlockNumber, positions[1].mChunkOffset, noFill).has_value());
+  ASSERT_EQ(cache->stats()[0].hits, hits + 1);
+  ASSERT_EQ(cache->size(), 1);
+  seg.remove();
+
+  removeDir(dir);
+}
+
+TEST(Segment, CacheTailBlock)
+{
+  auto dir = fs::temp_directory_path() / "seg-test-cache-tail";
+  fs::create_directories(dir);
+  auto cache = std::make_shared<BlockCache>(4 * kBlockSize, 0, 1);
+  auto seg = Segment(dir.string(), ".SIG", 1, cache);
+
+  auto value = [](int i) { return std::vector<std::byte>(100, std::byte(i)); };
+  auto first = seg.write(value(1));
+  ASSERT_TRUE(first.has_value());
+  ASSERT_TRUE(seg.read(first->mBlockNumber, first->mChunkOffset).has_value());
+  ASSERT_EQ(cache->size(), 1);
+  ASSERT_EQ(cache->weight(), 100 + kChunkHeaderSize);
+
+  // the tail grows, the cached block is extended instead of being served stale
+  auto second = seg.write(value(2));
+  ASSERT_TRUE(second.has_value());
+  auto v = seg.read(second->mBlockNumber, second->mChunkOffset);
+  ASSERT_TRUE(v.has_value());
+  ASSERT_TRUE(v->span() == value(2));
+  ASSERT_EQ(cache->weight(), 2 * (100 + kChunkHeaderSize));
+
+  auto hits = cache->stats()[0].hits;
+  v = seg.read(first->mBlockNumber, first->mChunkOffset);
+  ASSERT_TRUE(v.has_value());
+  ASSERT_TRUE(v->span() == value(1));
+  ASSERT_EQ(cache->stats()[0].hits, hits + 1);
+
+  // the byte budget bounds the cache no matter how many blocks are read
+  auto positions = std::vector<ChunkPosition>();
+  for (auto i = 0; i < 2000; i++) {
+    auto pos = seg.write(value(i));
+    ASSERT_TRUE(pos.has_value());
+    positions.push_back(*pos);
+  }
+  for (auto i = 0; i < positions.size(); i++) {
+    auto v = seg.read(positions[i].mBlockNumber, positions[i].mChunkOffset);
+    ASSERT_TRUE(v.has_value());
+    ASSERT_TRUE(v->span() == value(i));
+  }
+  ASSERT_LE(cache->weight(), cache->capacity());
+  seg.remove();
+
+  removeDir(dir);
+}
+
+TEST(Segment, ReaderReadahead)
+{
+  auto dir = fs::temp_directory_path() / "seg-test-readahead";
+  fs::create_directories(dir);
+  auto seg = Segment(dir.string(), ".SIG", 1, nullptr);
+
+  auto value = [](int i) { return std::vector<std::byte>(100 + i * 37 % (kBlockSize * 2), std::byte(i % 256)); };
+  auto positions = std::vector<ChunkPosition>();
+  for (auto i = 0; i < 1000; i++) {
+    auto pos = seg.write(value(i));
+    ASSERT_TRUE(pos.has_value());
+    positions.push_back(*pos);
+  }
+
+  auto reader = seg.reader(ReadOption{.readahead = 4 * kBlockSize});
+  auto index = 0;
+  for (;;) {
+    auto rpos = ChunkPosition();
+    auto v = reader.next(rpos);
+    if (!v.has_value()) {
+      ASSERT_TRUE(v.error() == SegmentErr::EndOfSegment);
+      break;
+    }
+    ASSERT_EQ(rpos, positions[index]);
+    ASSERT_TRUE(v->span() == value(index));
+    index++;
+
+    // the segment keeps growing behind the reader
+    if (index == 500) {
+      auto pos = seg.write(value(1000));
+      ASSERT_TRUE(pos.has_value());
+      positions.push_back(*pos);
+    }
+  }
+  ASSERT_EQ(index, positions.size());
+  seg.remove();
+
+  removeDir(dir);
+}
+
+TEST(Segment, ReaderNextHead)
+{
+  auto dir = fs::temp_directory_path() / "seg-test-next-head";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  auto seg = Segment(dir.string(), ".SIG", 1, nullptr);
+
+  // every value starts with its own size, the head a reader asks for is the size and 12 more bytes
+  auto value = [](int i) {
+    auto data = std::vector<std::byte>(16 + i * 4099 % (kBlockSize * 5), std::byte(i % 256));
+    auto size = std::uint32_t(data.size());
+    std::memcpy(data.data(), &size, sizeof(size));
+    return data;
+  };
+  auto measure = ChunkHeadFn([](std::span<std::byte const> head) -> std::optional<ChunkHead> {
+    if (head.size() < sizeof(std::uint32_t)) {
+      return std::nullopt;
+    }
+    auto size = std::uint32_t();
+    std::memcpy(&size, head.data(), sizeof(size));
+    return ChunkHead{.head = 16, .size = size};
+  });
+  auto positions = std::vector<ChunkPosition>();
+  for (auto i = 0; i < 300; i++) {
+    auto pos = seg.write(value(i));
+    ASSERT_TRUE(pos.has_value());
+    positions.push_back(*pos);
+  }
+
+  for (auto readahead : {0u, std::uint32_t(4 * kBlockSize)}) {
+    auto reader = seg.reader(ReadOption{.readahead = readahead});
+    auto index = 0;
+    for (;;) {
+      auto rpos = ChunkPosition();
+      auto v = reader.nextHead(rpos, measure);
+      if (!v.has_value()) {
+        ASSERT_TRUE(v.error() == SegmentErr::EndOfSegment);
+        break;
+      }
+      ASSERT_EQ(rpos, positions[index]);
+      ASSERT_EQ(rpos.mChunkSize, positions[index].mChunkSize);
+      ASSERT_GE(v->capacity(), 16);
+      auto expected = value(index);
+      ASSERT_TRUE(v->span().first(16) == std::span<std::byte const>(expected).first(16));
+      index++;
+    }
+    ASSERT_EQ(index, positions.size());
+  }
+
+  // the end of a torn record lies past the end of the segment
+  auto data = value(7);
+  data.resize(kBlockSize * 3);
+  auto size = std::uint32_t(kBlockSize * 4);
+  std::memcpy(data.data(), &size, sizeof(size));
+  ASSERT_TRUE(seg.write(data).has_value());
+  auto reader = seg.reader();
+  auto rpos = ChunkPosition();
+  for (auto i = 0; i < 300; i++) {
+    ASSERT_TRUE(reader.nextHead(rpos, measure).has_value());
+  }
+  auto v = reader.nextHead(rpos, measure);
+  ASSERT_FALSE(v.has_value());
+  ASSERT_TRUE(v.error() == SegmentErr::EndOfSegment);
+  seg.remove();
+
+  removeDir(dir);
+}
+
+TEST(Segment, ReadLegacyCrc32Chunk)
+{
+  auto dir = fs::temp_directory_path() / "seg-test-legacy-crc";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+
+  // a chunk as written before crc32c, its type byte has no checksum flag
+  auto const data = std::vector<std::byte>(100, std::byte(0x42));
+  auto header = ChunkHeader{.mLength = std::uint16_t(data.size()), .mType = ChunkType::Full};
+  header.mCrc = crc32(data, crc32((std::byte const*)(&header) + 4, 3));
+  {
+    auto file = np_linux::File::open(segmentFileName(dir.string(), ".SIG", 1), "a+b");
+    ASSERT_TRUE(file.has_value());
+    ASSERT_TRUE(file->write(&header, kChunkHeaderSize));
+    ASSERT_TRUE(file->write(data));
+  }
+
+  auto seg = Segment(dir.string(), ".SIG", 1, nullptr);
+  auto v = seg.read(0, 0);
+  ASSERT_TRUE(v.has_value());
+  ASSERT_TRUE(v->span() == data);
+
+  // new chunks appended to the same segment use crc32c
+  auto pos = seg.write(data);
+  ASSERT_TRUE(pos.has_value());
+  auto reader = seg.reader();
+  for (auto i = 0; i < 2; i++) {
+    auto rpos = ChunkPosition();
+    auto v = reader.next(rpos);
+    ASSERT_TRUE(v.has_value());
+    ASSERT_TRUE(v->span() == data);
+  }
+  seg.remove();
+
+  removeDir(dir);
+}
+
+TEST(Segment, VerifyChecksumOnLoad)
+{
+  auto dir = fs::temp_directory_path() / "seg-test-verify-on-load";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  auto cache = std::make_shared<BlockCache>(4 * kBlockSize, 0, 1);
+  auto seg = Segment(dir.string(), ".SIG", 1, cache);
+
+  auto const data = std::vector<std::byte>(100, std::byte(0x42));
+  auto first = seg.write(data);
+  auto second = seg.write(data);
+  auto empty = seg.write(std::vector<std::byte>());
+  ASSERT_TRUE(first && second && empty);
+  ASSERT_TRUE(seg.sync() == SegmentErr::Ok);
+
+  // a corrupted chunk fails the whole block when it is loaded, even if another chunk is asked for
+  {
+    auto fd = ::open(segmentFileName(dir.string(), ".SIG", 1).c_str(), O_WRONLY);
+    ASSERT_NE(fd, -1);
+    auto byte = std::byte(0x43);
+    ASSERT_EQ(::pwrite(fd, &byte, 1, second->mChunkOffset + kChunkHeaderSize), 1);
+    ::close(fd);
+  }
+  seg.setChecksumMode(ChecksumMode::OnLoad);
+  auto v = seg.read(first->mBlockNumber, first->mChunkOffset);
+  ASSERT_FALSE(v.has_value());
+  ASSERT_TRUE(v.error() == SegmentErr::InvalidCheckSum);
+  ASSERT_TRUE(cache->empty());
+
+  seg.setChecksumMode(ChecksumMode::Always);
+  ASSERT_TRUE(seg.read(first->mBlockNumber, first->mChunkOffset).has_value());
+  ASSERT_EQ(cache->size(), 1);
+  cache->clear();
+
+  seg.remove();
+
+  // once a block is cached its chunks are not verified again in on-load mode
+  auto seg2 = Segment(dir.string(), ".SIG", 2, cache);
+  seg2.setChecksumMode(ChecksumMode::OnLoad);
+  auto pos = seg2.write(data);
+  ASSERT_TRUE(pos.has_value());
+  ASSERT_TRUE(seg2.read(pos->mBlockNumber, pos->mChunkOffset).has_value());
+  auto block = cache->get(std::uint64_t(2) << 32 | pos->mBlockNumber);
+  ASSERT_TRUE(block.has_value());
+  block->data()[pos->mChunkOffset + kChunkHeaderSize] = std::byte(0x44);
+  ASSERT_TRUE(seg2.read(pos->mBlockNumber, pos->mChunkOffset).has_value());
+  seg2.setChecksumMode(ChecksumMode::Always);
+  ASSERT_FALSE(seg2.read(pos->mBlockNumber, pos->mChunkOffset).has_value());
+  seg2.remove();
+
+  removeDir(dir);
+}
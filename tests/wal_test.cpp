@@ -3,6 +3,7 @@
 #include "../wal.hpp"
 #include <filesystem>
 #include <string_view>
+#include <thread>
 
 using namespace std::literals;
 namespace fs = std::filesystem;
@@ -257,4 +258,367 @@ TEST(WAL, Delete)
   testWriteAndIterate(wal.get(), 2000, 512);
 
   destroyWAL(*wal);
-}
\ No newline at end of file
+}
+TEST(WAL, MmapSealedSegments)
+{
+  auto dir = fs::temp_directory_path() / "wal-test-mmap-sealed";
+  fs::create_directories(dir);
+
+  auto ops = WalOption{
+      .dirPath = dir.string(),
+      .segmentSize = 3l * 1024 * 1024,
+      .segmentFileExt = ".SEG",
+      .blockCache = 3 * 1024 * 10,
+      .mmapSealedSegments = true,
+  };
+
+  auto walResult = Wal::create(ops);
+  ASSERT_TRUE(walResult);
+  auto wal = std::move(walResult).value();
+
+  auto const small = std::vector<std::byte>(512, std::byte{0x23});
+  auto const large = std::vector<std::byte>(32 * 1024 * 2 + 10, std::byte{0x24});
+  auto positions = std::vector<ChunkPosition>{};
+  for (int i = 0; i < 5000; i++) {
+    auto pos = wal->write(i % 10 == 0 ? large : small);
+    ASSERT_TRUE(pos.has_value());
+    positions.push_back(*pos);
+  }
+  ASSERT_GT(wal->activeSegmentID(), 1);
+
+  auto validate = [&](Wal& wal) {
+    for (int i = 0; i < positions.size(); i++) {
+      auto data = wal.read(positions[i]);
+      ASSERT_TRUE(data.has_value());
+      ASSERT_TRUE(eq(data->span(), i % 10 == 0 ? large : small));
+    }
+    auto reader = wal.reader();
+    auto index = 0;
+    for (;;) {
+      auto pos = ChunkPosition();
+      auto data = reader.next(pos);
+      if (!data && data.error() == WalErr::EndOfSegments) {
+        break;
+      }
+      ASSERT_TRUE(data.has_value());
+      ASSERT_TRUE(pos == positions[index]);
+      ASSERT_TRUE(eq(data->span(), index % 10 == 0 ? large : small));
+      index++;
+    }
+    ASSERT_EQ(index, positions.size());
+  };
+  validate(*wal);
+
+  wal->close();
+  walResult = Wal::create(ops);
+  ASSERT_TRUE(walResult);
+  auto wal2 = std::move(walResult).value();
+  auto first = wal2->read(positions.front());
+  ASSERT_TRUE(first.has_value());
+  ASSERT_TRUE(eq(first->span(), large));
+
+  destroyWAL(*wal2);
+}
+
+TEST(WAL, IoUringReadMany)
+{
+  auto dir = fs::temp_directory_path() / "wal-test-io-uring";
+  fs::create_directories(dir);
+
+  auto ops = WalOption{
+      .dirPath = dir.string(),
+      .segmentSize = 3l * 1024 * 1024,
+      .segmentFileExt = ".SEG",
+      .blockCache = 3 * 1024 * 10,
+      .syncWrite = true,
+      .ioType = IoType::IoUring,
+  };
+
+  auto walResult = Wal::create(ops);
+  ASSERT_TRUE(walResult);
+  auto wal = std::move(walResult).value();
+  testWriteAndIterate(wal.get(), 2000, 32 * 1024 + 10);
+
+  auto values = std::vector<std::vector<std::byte>>();
+  auto positions = std::vector<ChunkPosition>();
+  for (int i = 0; i < 500; i++) {
+    values.emplace_back(100 + i * 131, std::byte(i % 256));
+    auto pos = wal->write(values.back());
+    ASSERT_TRUE(pos.has_value());
+    positions.push_back(*pos);
+  }
+  std::reverse(positions.begin(), positions.end());
+  std::reverse(values.begin(), values.end());
+
+  auto results = wal->readMany(positions);
+  ASSERT_EQ(results.size(), positions.size());
+  for (int i = 0; i < results.size(); i++) {
+    ASSERT_TRUE(results[i].has_value());
+    ASSERT_TRUE(eq(results[i]->span(), values[i]));
+  }
+
+  destroyWAL(*wal);
+}
+
+TEST(WAL, GroupCommit)
+{
+  auto dir = fs::temp_directory_path() / "wal-test-group-commit";
+  fs::create_directories(dir);
+
+  auto ops = WalOption{
+      .dirPath = dir.string(),
+      .segmentSize = 1l * 1024 * 1024,
+      .segmentFileExt = ".SEG",
+      .blockCache = 3 * 1024 * 10,
+      .syncWrite = true,
+  };
+
+  auto walResult = Wal::create(ops);
+  ASSERT_TRUE(walResult);
+  auto wal = std::move(walResult).value();
+
+  constexpr auto kThreads = 8;
+  constexpr auto kWrites = 200;
+  auto positions = std::vector<std::vector<ChunkPosition>>(kThreads);
+  auto threads = std::vector<std::thread>();
+  for (auto t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t] {
+      auto const data = std::vector<std::byte>(100 + t * 1000, std::byte(t));
+      for (auto i = 0; i < kWrites; i++) {
+        auto records = std::vector<std::span<std::byte const>>{data, data};
+        auto pos = wal->writeBatch(records, false);
+        if (pos.has_value()) {
+          positions[t].insert(positions[t].end(), pos->begin(), pos->end());
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_GT(wal->activeSegmentID(), 1);
+
+  auto count = 0;
+  for (auto t = 0; t < kThreads; t++) {
+    ASSERT_EQ(positions[t].size(), kWrites * 2);
+    auto const data = std::vector<std::byte>(100 + t * 1000, std::byte(t));
+    for (auto const& pos : positions[t]) {
+      auto value = wal->read(pos);
+      ASSERT_TRUE(value.has_value());
+      ASSERT_TRUE(eq(value->span(), data));
+      count++;
+    }
+  }
+
+  auto reader = wal->reader();
+  auto index = 0;
+  for (;;) {
+    auto pos = ChunkPosition();
+    auto data = reader.next(pos);
+    if (!data && data.error() == WalErr::EndOfSegments) {
+      break;
+    }
+    ASSERT_TRUE(data.has_value());
+    index++;
+  }
+  ASSERT_EQ(index, count);
+
+  destroyWAL(*wal);
+}
+
+TEST(WAL, GroupCommitSegmentSize)
+{
+  auto dir = fs::temp_directory_path() / "wal-test-group-commit-size";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+
+  // every record leaves a block tail too short for a header, the padding of all but the last one
+  // pushes 32 records past a segment that only counts their chunks
+  constexpr auto kData = kBlockSize - kChunkHeaderSize - 6;
+  auto ops = WalOption{
+      .dirPath = dir.string(),
+      .segmentSize = std::int64_t(32 * (kData + kChunkHeaderSize) + 31 * 6 - 1),
+      .segmentFileExt = ".SEG",
+      .blockCache = 3 * 1024 * 10,
+  };
+  auto walResult = Wal::create(ops);
+  ASSERT_TRUE(walResult);
+  auto wal = std::move(walResult).value();
+
+  auto const data = std::vector<std::byte>(kData, std::byte(1));
+  auto records = std::vector<std::span<std::byte const>>(100, data);
+  auto positions = wal->writeBatch(records, true);
+  ASSERT_TRUE(positions);
+  for (auto const& pos : *positions) {
+    auto value = wal->read(pos);
+    ASSERT_TRUE(value.has_value());
+    ASSERT_TRUE(eq(value->span(), data));
+  }
+  for (auto const& entry : fs::directory_iterator(dir)) {
+    ASSERT_LE(std::int64_t(entry.file_size()), ops.segmentSize) << entry.path();
+  }
+
+  destroyWAL(*wal);
+}
+
+TEST(WAL, GroupCommitErrors)
+{
+  auto dir = fs::temp_directory_path() / "wal-test-group-commit-errors";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+
+  auto ops = WalOption{
+      .dirPath = dir.string(),
+      .segmentSize = 256 * 1024,
+      .segmentFileExt = ".SEG",
+      .blockCache = 3 * 1024 * 10,
+  };
+  auto walResult = Wal::create(ops);
+  ASSERT_TRUE(walResult);
+  auto wal = std::move(walResult).value();
+
+  // the next segment can not be opened, every group that needs it fails part way
+  auto blocked = fs::path(segmentFileName(dir.string(), ".SEG", 2));
+  fs::create_directories(blocked);
+  constexpr auto kThreads = 8;
+  constexpr auto kWrites = 50;
+  auto written = std::vector<std::vector<ChunkPosition>>(kThreads);
+  auto applied = std::vector<int>(kThreads);
+  auto failed = std::atomic_int(0);
+  auto threads = std::vector<std::thread>();
+  for (auto t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t] {
+      auto const data = std::vector<std::byte>(4 * 1024, std::byte(t));
+      for (auto i = 0; i < kWrites; i++) {
+        auto records = std::vector<std::span<std::byte const>>{data, data};
+        auto apply = Wal::ApplyFn([&](std::span<ChunkPosition const>) { applied[t]++; });
+        if (auto pos = wal->writeBatch(records, false, apply); pos) {
+          written[t].insert(written[t].end(), pos->begin(), pos->end());
+        } else {
+          failed++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_GT(failed.load(), 0);
+  for (auto t = 0; t < kThreads; t++) {
+    // only callers whose records were all written are applied, and those succeed without a sync
+    ASSERT_EQ(std::size_t(applied[t]) * 2, written[t].size());
+    auto const data = std::vector<std::byte>(4 * 1024, std::byte(t));
+    for (auto const& pos : written[t]) {
+      auto value = wal->read(pos);
+      ASSERT_TRUE(value.has_value());
+      ASSERT_TRUE(eq(value->span(), data));
+    }
+  }
+  ASSERT_EQ(wal->activeSegmentID(), 1);
+
+  // an apply that throws fails its caller only, the next group goes on
+  fs::remove_all(blocked);
+  auto const data = std::vector<std::byte>(4 * 1024, std::byte(9));
+  auto records = std::vector<std::span<std::byte const>>{data};
+  auto throwing = Wal::ApplyFn([](std::span<ChunkPosition const>) { throw std::runtime_error("apply"); });
+  auto r = wal->writeBatch(records, false, throwing);
+  ASSERT_FALSE(r.has_value());
+  ASSERT_TRUE(r.error() == WalErr::CommitFailed);
+  auto ok = wal->writeBatch(records, true);
+  ASSERT_TRUE(ok.has_value());
+  ASSERT_EQ(wal->activeSegmentID(), 2);
+
+  destroyWAL(*wal);
+}
+
+TEST(WAL, WriteBuffer)
+{
+  auto dir = fs::temp_directory_path() / "wal-test-write-buffer";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+
+  auto ops = WalOption{
+      .dirPath = dir.string(),
+      .segmentSize = 3l * 1024 * 1024,
+      .segmentFileExt = ".SEG",
+      .blockCache = 3 * 1024 * 10,
+      .writeBufferSize = 64 * 1024,
+  };
+  auto walResult = Wal::create(ops);
+  ASSERT_TRUE(walResult);
+  auto wal = std::move(walResult).value();
+
+  auto const small = std::vector<std::byte>(100, std::byte{0x23});
+  auto const large = std::vector<std::byte>(32 * 1024 + 10, std::byte{0x24});
+  auto positions = std::vector<ChunkPosition>{};
+  for (int i = 0; i < 2000; i++) {
+    auto pos = wal->write(i % 50 == 0 ? large : small);
+    ASSERT_TRUE(pos.has_value());
+    positions.push_back(*pos);
+  }
+  // the tail of the log is only in the write buffer, reads must still see it
+  auto segmentFile = dir / std::format("{:09}.SEG", wal->activeSegmentID());
+  auto const& last = positions.back();
+  ASSERT_LT(fs::file_size(segmentFile), last.mBlockNumber * kBlockSize + last.mChunkOffset + last.mChunkSize);
+  for (int i = 0; i < positions.size(); i++) {
+    auto data = wal->read(positions[i]);
+    ASSERT_TRUE(data.has_value());
+    ASSERT_TRUE(eq(data->span(), i % 50 == 0 ? large : small));
+  }
+
+  ASSERT_FALSE(wal->flush());
+  auto size = fs::file_size(segmentFile);
+  auto pos = wal->writeBatch(std::vector<std::span<std::byte const>>{small}, true);
+  ASSERT_TRUE(pos.has_value());
+  ASSERT_EQ(fs::file_size(segmentFile), size + small.size() + kChunkHeaderSize);
+  positions.push_back(pos->front());
+
+  wal->close();
+  walResult = Wal::create(ops);
+  ASSERT_TRUE(walResult);
+  auto wal2 = std::move(walResult).value();
+  auto reader = wal2->reader();
+  auto index = 0;
+  for (;;) {
+    auto pos = ChunkPosition();
+    auto data = reader.next(pos);
+    if (!data && data.error() == WalErr::EndOfSegments) {
+      break;
+    }
+    ASSERT_TRUE(data.has_value());
+    ASSERT_TRUE(pos == positions[index]);
+    index++;
+  }
+  ASSERT_EQ(index, positions.size());
+
+  destroyWAL(*wal2);
+}
+
+TEST(WAL, FlushInterval)
+{
+  auto dir = fs::temp_directory_path() / "wal-test-flush-interval";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+
+  auto ops = WalOption{
+      .dirPath = dir.string(),
+      .segmentSize = 3l * 1024 * 1024,
+      .segmentFileExt = ".SEG",
+      .blockCache = 3 * 1024 * 10,
+      .writeBufferSize = 1024 * 1024,
+      .flushInterval = 10ms,
+  };
+  auto walResult = Wal::create(ops);
+  ASSERT_TRUE(walResult);
+  auto wal = std::move(walResult).value();
+
+  auto const data = std::vector<std::byte>(100, std::byte{0x23});
+  ASSERT_TRUE(wal->write(data).has_value());
+  auto segmentFile = dir / std::format("{:09}.SEG", wal->activeSegmentID());
+  for (int i = 0; i < 500 && fs::file_size(segmentFile) == 0; i++) {
+    std::this_thread::sleep_for(10ms);
+  }
+  ASSERT_EQ(fs::file_size(segmentFile), data.size() + kChunkHeaderSize);
+
+  destroyWAL(*wal);
+}
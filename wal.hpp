@@ -3,23 +3,44 @@
 #include "segment.hpp"
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
 #include <mutex>
 #include <shared_mutex>
+#include <thread>
 #include <vector>
 
 constexpr std::size_t kInitSegmentFileID = 1;
 
+// a point in the log: everything before `mOffset` of segment `mSegmentID` and all segments before it
+struct WalPosition {
+  SegmentID mSegmentID = 0;
+  std::int64_t mOffset = 0;
+};
+
 class WALReader;
 
 class Wal {
 public:
+  using ApplyFn = std::function<void(std::span<ChunkPosition const>)>;
+  using SealFn = std::function<void(SegmentID)>;
+
   Wal(std::shared_ptr<Segment> activeSegment, std::map<SegmentID, std::shared_ptr<Segment>> olderSegments,
-      WalOption const& option, std::shared_ptr<Cache<std::uint64_t, Bytes>> blockCache,
-      std::uint32_t bytesWrite) noexcept
+      WalOption const& option, std::shared_ptr<BlockCache> blockCache,
+      std::shared_ptr<IoBackend> io, std::uint32_t bytesWrite) noexcept
       : mActiveSegment(std::move(activeSegment)), mOlderSegments(std::move(olderSegments)), mOption(option),
-        mBlockCache(std::move(blockCache)), mBytesWrite(bytesWrite)
+        mBlockCache(std::move(blockCache)), mIo(std::move(io)), mBytesWrite(bytesWrite)
   {
+    mActiveSegment->setWriteBuffer(mOption.writeBufferSize);
+    mActiveSegment->setChecksumMode(mOption.checksumMode);
+    for (auto const& [id, segment] : mOlderSegments) {
+      segment->setChecksumMode(mOption.checksumMode);
+    }
+    if (mOption.writeBufferSize > 0 && mOption.flushInterval.count() > 0) {
+      mFlusher = std::thread([this] { flushLoop(); });
+    }
   }
   ~Wal() { close(); }
   static auto create(WalOption const& option) -> ext::expected<std::unique_ptr<Wal>, std::error_code>
@@ -30,19 +51,19 @@ public:
     if (option.blockCache > option.segmentSize) {
       return ext::make_unexpected(WalErr::InvalidOption);
     }
+    if (option.ioType == IoType::IoUring && !UringIo::available()) {
+      return ext::make_unexpected(WalErr::InvalidOption);
+    }
     namespace fs = std::filesystem;
     std::error_code ec;
     
     fs::create_directories(option.dirPath);
 
-    auto blockCache = std::shared_ptr<Cache<std::uint64_t, Bytes>>();
+    auto blockCache = std::shared_ptr<BlockCache>();
     if (option.blockCache > 0) {
-      auto lruSize = option.blockCache / kBlockSize;
-      if (option.blockCache % kBlockSize != 0) {
-        lruSize++;
-      }
-      blockCache = std::make_unique<Cache<std::uint64_t, Bytes>>(lruSize);
+      blockCache = std::make_shared<BlockCache>(option.blockCache, 0, kDefaultCacheShards, option.cachePolicy);
     }
+    auto io = makeIoBackend(option.ioType);
     auto segmentIDs = std::vector<SegmentID>();
 
     auto entry_iter = fs::directory_iterator(option.dirPath);
@@ -62,128 +83,198 @@ public:
     auto activeSegment = std::shared_ptr<Segment>();
     auto olderSegments = std::map<SegmentID, std::shared_ptr<Segment>>();
     if (segmentIDs.empty()) {
-      activeSegment =
-          std::make_shared<Segment>(option.dirPath.string(), option.segmentFileExt, kInitSegmentFileID, blockCache);
+      activeSegment = std::make_shared<Segment>(option.dirPath.string(), option.segmentFileExt, kInitSegmentFileID,
+                                                blockCache, io);
     } else {
       std::sort(segmentIDs.begin(), segmentIDs.end());
       for (auto i = 0; i < segmentIDs.size(); i++) {
-        auto segment =
-            std::make_shared<Segment>(option.dirPath.string(), option.segmentFileExt, segmentIDs[i], blockCache);
+        auto segment = std::make_shared<Segment>(option.dirPath.string(), option.segmentFileExt, segmentIDs[i],
+                                                 blockCache, io);
         if (i == segmentIDs.size() - 1) {
           activeSegment = segment;
         } else {
+          if (option.mmapSealedSegments) {
+            if (auto err = segment->seal(); err) {
+              return ext::make_unexpected(err);
+            }
+          }
           olderSegments[segmentIDs[i]] = segment;
         }
       }
     }
-    return std::make_unique<Wal>(activeSegment, olderSegments, option, std::move(blockCache), 0);
+    return std::make_unique<Wal>(activeSegment, olderSegments, option, std::move(blockCache), std::move(io), 0);
   }
 
-  auto isFull(std::int64_t delta) const -> bool
-  {
-    return mActiveSegment->size() + delta + kChunkHeaderSize > mOption.segmentSize;
-  }
   auto empty() const -> bool
   {
     auto lk = std::shared_lock(mMutex);
     return mOlderSegments.empty() && mActiveSegment->size() == 0;
   }
   auto option() const -> WalOption const& { return mOption; }
+  // bytes of blocks currently held by the block cache
+  auto blockCacheUsage() const -> std::size_t { return mBlockCache != nullptr ? mBlockCache->weight() : 0; }
   auto activeSegmentID() const -> SegmentID
   {
     auto lk = std::shared_lock(mMutex);
     return mActiveSegment->id();
   }
+  // the end of the log, where the next record will be written
+  auto endPosition() const -> WalPosition
+  {
+    auto lk = std::shared_lock(mMutex);
+    return WalPosition{mActiveSegment->id(), std::int64_t(mActiveSegment->size())};
+  }
+  // the segment with `id`, nullptr if there is none
+  auto segment(SegmentID id) const -> std::shared_ptr<Segment>
+  {
+    auto lk = std::shared_lock(mMutex);
+    if (id == mActiveSegment->id()) {
+      return mActiveSegment;
+    }
+    auto iter = mOlderSegments.find(id);
+    return iter == mOlderSegments.end() ? nullptr : iter->second;
+  }
+  auto sealedSegmentIDs() const -> std::vector<SegmentID>
+  {
+    auto lk = std::shared_lock(mMutex);
+    auto ids = std::vector<SegmentID>();
+    for (auto const& [id, segment] : mOlderSegments) {
+      ids.push_back(id);
+    }
+    return ids;
+  }
+  // `onSeal` is called with the id of every segment sealed from now on, while the wal is locked
+  auto setSealHandler(SealFn onSeal) -> void
+  {
+    auto lk = std::scoped_lock(mMutex);
+    mOnSeal = std::move(onSeal);
+  }
   auto useNewAciveSegment() -> std::error_code
   {
     auto lk = std::scoped_lock(mMutex);
-
-    if (auto err = mActiveSegment->sync(); err) {
-      return err;
-    }
-    auto newSegment = std::make_shared<Segment>(mOption.dirPath.string(), mOption.segmentFileExt,
-                                                mActiveSegment->id() + 1, mBlockCache);
-
-    mOlderSegments[mActiveSegment->id()] = mActiveSegment;
-    mActiveSegment = newSegment;
-    return SegmentErr::Ok;
+    return rotateSegment();
   }
   auto write(std::span<std::byte const> data) -> ext::expected<ChunkPosition, std::error_code>
   {
-    auto lk = std::scoped_lock(mMutex);
-
-    if (data.size() + kChunkHeaderSize > mOption.segmentSize) {
-      return ext::make_unexpected(WalErr::TooLargeValue);
+    auto positions = writeBatch(std::span(&data, 1), false);
+    if (!positions) {
+      return ext::make_unexpected(positions.error());
     }
-    if (isFull(data.size())) {
-      auto err = mActiveSegment->sync();
-      if (err) {
-        return ext::make_unexpected(err);
+    return {positions->front()};
+  }
+  // group commit: concurrent callers queue up, the caller at the head of the queue becomes the leader
+  // and appends the records of every queued caller in one write followed by at most one fsync. before
+  // releasing the group the leader runs each caller's `apply` in commit order. when the group fails
+  // part way, the callers whose records were all written are still applied, they are in the log and
+  // come back after a restart. of those only the ones whose fsync did not happen see the error.
+  auto writeBatch(std::span<std::span<std::byte const> const> records, bool sync, ApplyFn const& apply = nullptr)
+      -> ext::expected<std::vector<ChunkPosition>, std::error_code>
+  {
+    for (auto const& data : records) {
+      if (sizeAfterAppend(0, data.size()) > mOption.segmentSize) {
+        return ext::make_unexpected(WalErr::TooLargeValue);
       }
-      mBytesWrite = 0;
-      auto segment = std::make_shared<Segment>(mOption.dirPath.string(), mOption.segmentFileExt,
-                                               mActiveSegment->id() + 1, mBlockCache);
-      mOlderSegments[mActiveSegment->id()] = mActiveSegment;
-      mActiveSegment = segment;
-      log_debug("create new segment %u\n", mActiveSegment->id());
     }
-
-    auto pos = mActiveSegment->write(data);
-    if (!pos.has_value()) {
-      return ext::make_unexpected(pos.error());
-    }
-    mBytesWrite += pos->mChunkSize;
-
-    auto needSync = mOption.syncWrite;
-    if (!needSync && mOption.bytesPerSync > 0) {
-      needSync = mBytesWrite >= mOption.bytesPerSync;
-    }
-
-    if (needSync) {
-      auto err = mActiveSegment->sync();
-      if (err) {
-        return ext::make_unexpected(err);
+    auto request = CommitRequest{.records = records, .sync = sync, .apply = &apply};
+
+    auto lk = std::unique_lock(mCommitMutex);
+    mCommitQueue.push_back(&request);
+    mCommitCv.wait(lk, [&] { return request.done || mCommitQueue.front() == &request; });
+    if (!request.done) {
+      auto group = std::vector<CommitRequest*>(mCommitQueue.begin(), mCommitQueue.end());
+      lk.unlock();
+      // the group leaves the queue however the leader gets out of here, its callers wait for that
+      auto release = Defer([&] {
+        auto commitLock = std::scoped_lock(mCommitMutex);
+        for (auto member : group) {
+          assert(mCommitQueue.front() == member);
+          mCommitQueue.pop_front();
+          member->done = true;
+        }
+        mCommitCv.notify_all();
+      });
+      auto err = catchErrors([&] { return writeGroup(group); });
+      for (auto member : group) {
+        if (err && member->positions.size() != member->records.size()) {
+          member->err = err;
+          member->positions.clear();
+          continue;
+        }
+        if (err && !member->synced && (member->sync || mOption.syncWrite)) {
+          member->err = err;
+        }
+        if (*member->apply) {
+          if (auto e = catchErrors([&] {
+                (*member->apply)(member->positions);
+                return std::error_code();
+              });
+              e) {
+            member->err = e;
+          }
+        }
       }
-      mBytesWrite = 0;
     }
-    return pos;
+    if (request.err) {
+      return ext::make_unexpected(request.err);
+    }
+    return {std::move(request.positions)};
   }
 
-  auto read(ChunkPosition const& pos) -> ext::expected<Bytes, std::error_code>
+  auto read(ChunkPosition const& pos, ReadOption const& option = {}) -> ext::expected<Bytes, std::error_code>
+  {
+    auto lk = std::shared_lock(mMutex);
+    return segmentOf(pos.mSegmentID)->read(pos.mBlockNumber, pos.mChunkOffset, option);
+  }
+  // read many chunks at once, the blocks of each segment are fetched with one batched submission
+  auto readMany(std::span<ChunkPosition const> positions) -> std::vector<ext::expected<Bytes, std::error_code>>
   {
     auto lk = std::shared_lock(mMutex);
 
-    Segment* segment = nullptr;
-    if (pos.mSegmentID == mActiveSegment->id()) {
-      segment = mActiveSegment.get();
-    } else {
-      auto iter = mOlderSegments.find(pos.mSegmentID);
-      if (iter == mOlderSegments.end()) {
-        throw std::runtime_error("segment not found");
+    auto bySegment = std::map<SegmentID, std::vector<std::size_t>>();
+    for (auto i = std::size_t(0); i < positions.size(); i++) {
+      bySegment[positions[i].mSegmentID].push_back(i);
+    }
+    auto results = std::vector<ext::expected<Bytes, std::error_code>>(positions.size());
+    for (auto const& [id, indexes] : bySegment) {
+      auto segPositions = std::vector<ChunkPosition>();
+      segPositions.reserve(indexes.size());
+      for (auto i : indexes) {
+        segPositions.push_back(positions[i]);
+      }
+      auto segResults = segmentOf(id)->readMany(segPositions);
+      for (auto i = std::size_t(0); i < indexes.size(); i++) {
+        results[indexes[i]] = std::move(segResults[i]);
       }
-      segment = iter->second.get();
     }
-    return segment->read(pos.mBlockNumber, pos.mChunkOffset);
+    return results;
   }
 
   auto close() -> bool
   {
+    stopFlusher();
     auto lk = std::scoped_lock(mMutex);
 
     if (mBlockCache != nullptr) {
       mBlockCache->clear();
     }
 
+    // a segment pinned by an iterator stays open until the iterator lets go of it
     for (auto const& [id, segment] : mOlderSegments) {
-      auto ok = segment->close();
-      assert(ok);
+      if (segment.use_count() == 1) {
+        auto ok = segment->close();
+        assert(ok);
+      }
     }
     mOlderSegments.clear();
+    if (mActiveSegment.use_count() > 1 && !mActiveSegment->isClosed()) {
+      return !mActiveSegment->flush();
+    }
     return mActiveSegment->close();
   }
 
   auto removeFiles() -> bool
   {
+    stopFlusher();
     auto lk = std::scoped_lock(mMutex);
     if (mBlockCache != nullptr) {
       mBlockCache->clear();
@@ -201,19 +292,203 @@ public:
     auto lk = std::scoped_lock(mMutex);
     return mActiveSegment->sync();
   }
+  // write out the active segment's write buffer without an fsync
+  auto flush() -> std::error_code
+  {
+    auto lk = std::scoped_lock(mMutex);
+    return mActiveSegment->flush();
+  }
 
-  auto readerWithMax(SegmentID segID) -> WALReader;
-  auto readerWithStart(SegmentID segID) -> WALReader;
-  auto reader() -> WALReader;
+  auto readerWithMax(SegmentID segID, ReadOption const& option = {}) -> WALReader;
+  auto readerWithStart(SegmentID segID, ReadOption const& option = {}) -> WALReader;
+  auto reader(ReadOption const& option = {}) -> WALReader;
 
 private:
+  struct CommitRequest {
+    std::span<std::span<std::byte const> const> records;
+    bool sync;
+    ApplyFn const* apply;
+    std::vector<ChunkPosition> positions;
+    std::error_code err;
+    // every record is written and synced to the file
+    bool synced = false;
+    bool done = false;
+  };
+
+  // the error `fn` returns, or the one of the exception it throws
+  static auto catchErrors(auto&& fn) -> std::error_code
+  {
+    try {
+      return fn();
+    } catch (std::system_error const& e) {
+      return e.code();
+    } catch (std::bad_alloc const&) {
+      return make_error_code(std::errc::not_enough_memory);
+    } catch (std::exception const&) {
+      return WalErr::CommitFailed;
+    }
+  }
+
+  auto writeGroup(std::span<CommitRequest* const> group) -> std::error_code
+  {
+    auto lk = std::scoped_lock(mMutex);
+
+    auto needSync = mOption.syncWrite;
+    auto pending = std::vector<std::span<std::byte const>>();
+    auto owners = std::vector<CommitRequest*>();
+    std::int64_t pendingSize = 0;
+    auto flush = [&](bool sync) -> std::error_code {
+      if (pending.empty()) {
+        return SegmentErr::Ok;
+      }
+      auto positions = mActiveSegment->writeAll(pending, sync);
+      if (!positions) {
+        return positions.error();
+      }
+      for (auto i = std::size_t(0); i < positions->size(); i++) {
+        owners[i]->positions.push_back((*positions)[i]);
+        mBytesWrite += (*positions)[i].mChunkSize;
+      }
+      pending.clear();
+      owners.clear();
+      pendingSize = 0;
+      return SegmentErr::Ok;
+    };
+
+    // where the active segment ends once the pending records are appended, padding included
+    auto end = std::int64_t(mActiveSegment->size());
+    for (auto member : group) {
+      needSync = needSync || member->sync;
+      member->positions.reserve(member->records.size());
+      for (auto const& data : member->records) {
+        auto next = sizeAfterAppend(end, data.size());
+        if (next > mOption.segmentSize) {
+          if (auto err = flush(false); err) {
+            return err;
+          }
+          if (auto err = rotateSegment(); err) {
+            return err;
+          }
+          // the rotation synced what was flushed before it
+          for (auto done : group) {
+            done->synced = done->positions.size() == done->records.size();
+          }
+          next = sizeAfterAppend(std::int64_t(mActiveSegment->size()), data.size());
+        }
+        pending.push_back(data);
+        owners.push_back(member);
+        pendingSize += data.size() + kChunkHeaderSize;
+        end = next;
+      }
+    }
+    if (!needSync && mOption.bytesPerSync > 0) {
+      needSync = mBytesWrite + pendingSize >= mOption.bytesPerSync;
+    }
+    // the fsync is handed to the io backend together with the append
+    if (auto err = flush(needSync); err) {
+      return err;
+    }
+    if (needSync) {
+      mBytesWrite = 0;
+    }
+    return SegmentErr::Ok;
+  }
+
+  // seal the active segment and start a new one, must hold `mMutex`. the new segment is opened
+  // first, so a failure leaves the active one as it was.
+  auto rotateSegment() -> std::error_code
+  {
+    // the index can not address segments past `kMaxSegmentID`
+    if (mActiveSegment->id() >= kMaxSegmentID) {
+      return WalErr::TooManySegments;
+    }
+    auto segment = std::shared_ptr<Segment>();
+    try {
+      segment = std::make_shared<Segment>(mOption.dirPath.string(), mOption.segmentFileExt,
+                                          mActiveSegment->id() + 1, mBlockCache, mIo);
+    } catch (std::system_error const& e) {
+      return e.code();
+    }
+    if (auto err = mActiveSegment->sync(); err) {
+      return err;
+    }
+    if (auto err = sealActiveSegment(); err) {
+      return err;
+    }
+    mBytesWrite = 0;
+    segment->setWriteBuffer(mOption.writeBufferSize);
+    segment->setChecksumMode(mOption.checksumMode);
+    mOlderSegments[mActiveSegment->id()] = mActiveSegment;
+    if (mOnSeal) {
+      mOnSeal(mActiveSegment->id());
+    }
+    mActiveSegment = segment;
+    log_debug("create new segment %u\n", mActiveSegment->id());
+    return SegmentErr::Ok;
+  }
+
+  auto flushLoop() -> void
+  {
+    auto lk = std::unique_lock(mFlusherMutex);
+    while (!mFlusherStop) {
+      if (mFlusherCv.wait_for(lk, mOption.flushInterval, [&] { return mFlusherStop; })) {
+        break;
+      }
+      lk.unlock();
+      if (auto err = flush(); err) {
+        log_error("flush active segment failed: %s\n", err.message().c_str());
+      }
+      lk.lock();
+    }
+  }
+  auto stopFlusher() -> void
+  {
+    if (!mFlusher.joinable()) {
+      return;
+    }
+    {
+      auto lk = std::scoped_lock(mFlusherMutex);
+      mFlusherStop = true;
+    }
+    mFlusherCv.notify_all();
+    mFlusher.join();
+  }
+
+  auto segmentOf(SegmentID id) -> Segment*
+  {
+    if (id == mActiveSegment->id()) {
+      return mActiveSegment.get();
+    }
+    auto iter = mOlderSegments.find(id);
+    if (iter == mOlderSegments.end()) {
+      throw std::runtime_error("segment not found");
+    }
+    return iter->second.get();
+  }
+  auto sealActiveSegment() -> std::error_code
+  {
+    if (!mOption.mmapSealedSegments) {
+      return SegmentErr::Ok;
+    }
+    return mActiveSegment->seal();
+  }
+
   std::shared_ptr<Segment> mActiveSegment;
   std::map<SegmentID, std::shared_ptr<Segment>> mOlderSegments;
 
   WalOption mOption;
   mutable std::shared_mutex mMutex;
-  std::shared_ptr<Cache<std::uint64_t, Bytes>> mBlockCache;
+  std::mutex mCommitMutex;
+  std::condition_variable mCommitCv;
+  std::deque<CommitRequest*> mCommitQueue;
+  std::shared_ptr<BlockCache> mBlockCache;
+  std::shared_ptr<IoBackend> mIo;
   std::uint32_t mBytesWrite;
+  SealFn mOnSeal;
+  std::mutex mFlusherMutex;
+  std::condition_variable mFlusherCv;
+  bool mFlusherStop = false;
+  std::thread mFlusher;
 };
 
 class WALReader {
@@ -256,20 +531,20 @@ private:
   std::uint32_t mCurrReader;
 };
 
-inline auto Wal::readerWithMax(SegmentID segID) -> WALReader
+inline auto Wal::readerWithMax(SegmentID segID, ReadOption const& option) -> WALReader
 {
   auto lk = std::shared_lock(mMutex);
 
   auto segmentReaders = std::vector<SegmentReader>();
   for (auto const& [id, segment] : mOlderSegments) {
     if (segID == 0 || segment->id() <= segID) {
-      auto reader = segment->reader();
+      auto reader = segment->reader(option);
       segmentReaders.push_back(reader);
     }
   }
 
   if (segID == 0 || mActiveSegment->id() <= segID) {
-    auto reader = mActiveSegment->reader();
+    auto reader = mActiveSegment->reader(option);
     segmentReaders.push_back(reader);
   }
 
@@ -277,4 +552,4 @@ inline auto Wal::readerWithMax(SegmentID segID) -> WALReader
   return WALReader{std::move(segmentReaders), 0};
 }
 
-inline auto Wal::reader() -> WALReader { return readerWithMax(0); }
\ No newline at end of file
+inline auto Wal::reader(ReadOption const& option) -> WALReader { return readerWithMax(0, option); }
\ No newline at end of file